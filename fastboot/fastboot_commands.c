@@ -1,5 +1,7 @@
 #include <stdlib.h>
 #include <string.h>
+#include <stdarg.h>
+#include <rand.h>
 
 #include <platform.h>
 #include <target.h>
@@ -12,6 +14,7 @@
 #include <dev/fbcon.h>
 #include <linux/elf.h>
 #include <kernel/thread.h>
+#include <kernel/event.h>
 #include <boot_stats.h>
 
 #if WITH_LIB_BIO
@@ -26,6 +29,34 @@
 #include <lib/boot.h>
 #endif
 
+#if DEVICE_TREE && defined(BOOT_STATS_IN_CHOSEN)
+#include <libfdt.h>
+#endif
+
+#ifdef WITH_LIB_BASE64
+#include <lib/base64.h>
+#endif
+
+#ifdef WITH_LIB_CRC32
+#include <lib/crc32.h>
+#endif
+
+#ifdef WITH_LIB_LZ4
+#include <lib/lz4.h>
+#endif
+
+#ifdef WITH_LIB_SHA256
+#include <lib/sha256.h>
+#endif
+
+#ifdef WITH_LIB_ZLIB_INFLATE
+#include <zlib.h>
+#endif
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+#endif
+
 #include "fastboot.h"
 #include "bootimg.h"
 
@@ -119,6 +150,42 @@ struct fastboot_cmd_desc {
 
 unsigned hex2unsigned(const char *x);
 
+// true if the whole string is a hex number as hex2unsigned reads it
+static bool is_hex(const char *x)
+{
+    if (x[0] == '0' && (x[1] == 'x' || x[1] == 'X'))
+        x += 2;
+    if (!*x)
+        return false;
+
+    for (; *x; x++) {
+        if (!((*x >= '0' && *x <= '9') || (*x >= 'a' && *x <= 'f') || (*x >= 'A' && *x <= 'F')))
+            return false;
+    }
+
+    return true;
+}
+
+// like hex2unsigned, for offsets and sizes beyond 4GB
+static uint64_t hex2u64(const char *x)
+{
+    uint64_t n = 0;
+
+    if (x[0] == '0' && (x[1] == 'x' || x[1] == 'X'))
+        x += 2;
+
+    for (;; x++) {
+        if (*x >= '0' && *x <= '9')
+            n = (n << 4) | (*x - '0');
+        else if (*x >= 'a' && *x <= 'f')
+            n = (n << 4) | (*x - 'a' + 10);
+        else if (*x >= 'A' && *x <= 'F')
+            n = (n << 4) | (*x - 'A' + 10);
+        else
+            return n;
+    }
+}
+
 void cmd_oem_reboot_recovery(const char *arg, void *data, unsigned sz)
 {
     fastboot_okay("");
@@ -145,9 +212,31 @@ void cmd_poweroff(const char *arg, void *data, unsigned sz)
 }
 
 #if WITH_DEBUG_LOG_BUF
+// offset up to which the log has been sent by lk_log or lk_log-tail
+static unsigned lk_log_cursor;
+
 void cmd_oem_lk_log(const char *arg, void *data, unsigned sz)
 {
-    fastboot_send_string_human(lk_log_getbuf(), lk_log_getsize());
+    // anything logged while sending goes to the next tail
+    unsigned size = lk_log_getsize();
+
+    fastboot_send_string_human(lk_log_getbuf(), size);
+    lk_log_cursor = size;
+    fastboot_okay("");
+}
+
+// sends only what has been logged since the last lk_log or lk_log-tail
+static void cmd_oem_lk_log_tail(const char *arg, void *data, unsigned sz)
+{
+    unsigned size = lk_log_getsize();
+
+    // the log got reset
+    if (lk_log_cursor > size)
+        lk_log_cursor = 0;
+
+    if (size > lk_log_cursor)
+        fastboot_send_string_human(lk_log_getbuf() + lk_log_cursor, size - lk_log_cursor);
+    lk_log_cursor = size;
     fastboot_okay("");
 }
 #endif
@@ -164,11 +253,79 @@ static char *get_human_size(double size, char *buf)
     return buf;
 }
 
+static char *get_human_throughput(uint64_t bytes, bigtime_t usecs, char *buf, size_t bufsize)
+{
+    uint64_t kbps = usecs ? (bytes * 1000000ULL / 1024) / usecs : 0;
+    snprintf(buf, bufsize, "%u.%02u MB/s", (uint32_t)(kbps / 1024), (uint32_t)((kbps % 1024) * 100 / 1024));
+    return buf;
+}
+
+// INFO text per packet, without the "INFO" prefix and the terminator
+#define INFO_PAYLOAD_SIZE (MAX_RSP_SIZE - 5)
+
+// collects lines and sends as many of them per INFO packet as fit,
+// because every packet is a separate round trip to the host
+typedef struct {
+    size_t len;
+    char buf[INFO_PAYLOAD_SIZE + 1];
+} info_writer_t;
+
+static void info_writer_init(info_writer_t *w)
+{
+    w->len = 0;
+}
+
+static void info_writer_flush(info_writer_t *w)
+{
+    if (!w->len)
+        return;
+
+    w->buf[w->len] = 0;
+    fastboot_info(w->buf);
+    w->len = 0;
+}
+
+static void info_writer_puts(info_writer_t *w, const char *line)
+{
+    size_t len = strlen(line);
+
+    // the end of a packet is a line break on the host, so lines
+    // only get split if they don't fit into an empty packet
+    if (w->len && w->len + 1 + len > INFO_PAYLOAD_SIZE)
+        info_writer_flush(w);
+    if (w->len)
+        w->buf[w->len++] = '\n';
+
+    while (len) {
+        size_t n = MIN(len, INFO_PAYLOAD_SIZE - w->len);
+
+        memcpy(w->buf + w->len, line, n);
+        w->len += n;
+        line += n;
+        len -= n;
+
+        if (len)
+            info_writer_flush(w);
+    }
+}
+
+static void info_writer_printf(info_writer_t *w, const char *fmt, ...)
+{
+    char line[256];
+    va_list ap;
+
+    va_start(ap, fmt);
+    vsnprintf(line, sizeof(line), fmt, ap);
+    va_end(ap);
+
+    info_writer_puts(w, line);
+}
+
 static void cmd_oem_ram_ptable(const char *arg, void *data, unsigned sz)
 {
     unsigned int i;
     ram_partition ptn_entry;
-    char buf[200];
+    info_writer_t info;
 
     // Make sure RAM partition table is initialized
     if (!smem_ram_ptable_init_v1()) {
@@ -177,68 +334,61 @@ static void cmd_oem_ram_ptable(const char *arg, void *data, unsigned sz)
     }
 
     // print header
-    fastboot_send_string_human("ID\tAddress                              \t  Size\tAttr\tCat\tDomain\tType\tParts\n", 0);
+    info_writer_init(&info);
+    info_writer_puts(&info, "ID\tAddress                              \t  Size\tAttr\tCat\tDomain\tType\tParts");
 
     // print table
     for (i = 0; i<smem_get_ram_ptable_len(); i++) {
         smem_get_ram_ptable_entry(&ptn_entry, i);
 
         char sizebuf[1024];
-        snprintf(buf, sizeof(buf), "%u:\t0x%016llx-0x%016llx\t%s\t%s\t%s\t%s\t%s\t%u\n", i,
+        info_writer_printf(&info, "%u:\t0x%016llx-0x%016llx\t%s\t%s\t%s\t%s\t%s\t%u", i,
                  ptn_entry.start, ptn_entry.start+ptn_entry.size,
                  get_human_size(ptn_entry.size, sizebuf), smem_attr2str(ptn_entry.attr),
                  smem_category2str(ptn_entry.category), smem_domain2str(ptn_entry.domain),
                  smem_type2str(ptn_entry.type), ptn_entry.num_partitions);
-        fastboot_send_string_human(buf, 0);
     }
 
+    info_writer_flush(&info);
     fastboot_okay("");
 }
 
 static void cmd_oem_fbconfig(const char *arg, void *data, unsigned sz)
 {
     struct fbcon_config *config = fbcon_display();
-    char buf[1024];
+    info_writer_t info;
 
-    fastboot_info("fbcon_config:");
+    info_writer_init(&info);
+    info_writer_puts(&info, "fbcon_config:");
 
-    snprintf(buf, sizeof(buf), "\tbase: %p (end: %p)", (void *)config->base, config->base + (config->width * config->height * config->bpp/3));
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "\twidth: %u", config->width);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "\theight: %u", config->height);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "\tstride: %u", config->stride);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "\tbpp: %u", config->bpp);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "\tformat: %u", config->format);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "\tupdate_start: %p", config->update_start);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "\tupdate_done: %p", config->update_done);
-    fastboot_info(buf);
+    info_writer_printf(&info, "\tbase: %p (end: %p)", (void *)config->base, config->base + (config->width * config->height * config->bpp/3));
+    info_writer_printf(&info, "\twidth: %u", config->width);
+    info_writer_printf(&info, "\theight: %u", config->height);
+    info_writer_printf(&info, "\tstride: %u", config->stride);
+    info_writer_printf(&info, "\tbpp: %u", config->bpp);
+    info_writer_printf(&info, "\tformat: %u", config->format);
+    info_writer_printf(&info, "\tupdate_start: %p", config->update_start);
+    info_writer_printf(&info, "\tupdate_done: %p", config->update_done);
 
+    info_writer_flush(&info);
     fastboot_okay("");
 }
 
 static void cmd_oem_bootaddresses(const char *arg, void *data, unsigned sz)
 {
-#ifdef ABOOT_IGNORE_BOOT_HEADER_ADDRS
-    char buf[1024];
+    info_writer_t info;
 
-    snprintf(buf, sizeof(buf), "kernel: 0x%08x", ABOOT_FORCE_KERNEL_ADDR);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "kernel64: 0x%016x", ABOOT_FORCE_KERNEL64_ADDR);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "ramdisk: 0x%08x", ABOOT_FORCE_RAMDISK_ADDR);
-    fastboot_info(buf);
-    snprintf(buf, sizeof(buf), "tags: 0x%08x", ABOOT_FORCE_TAGS_ADDR);
-    fastboot_info(buf);
+    info_writer_init(&info);
+#ifdef ABOOT_IGNORE_BOOT_HEADER_ADDRS
+    info_writer_printf(&info, "kernel: 0x%08x", ABOOT_FORCE_KERNEL_ADDR);
+    info_writer_printf(&info, "kernel64: 0x%016x", ABOOT_FORCE_KERNEL64_ADDR);
+    info_writer_printf(&info, "ramdisk: 0x%08x", ABOOT_FORCE_RAMDISK_ADDR);
+    info_writer_printf(&info, "tags: 0x%08x", ABOOT_FORCE_TAGS_ADDR);
 #else
-    fastboot_info("from boot image");
+    info_writer_puts(&info, "from boot image");
 #endif
 
+    info_writer_flush(&info);
     fastboot_okay("");
 }
 
@@ -348,10 +498,152 @@ typedef struct {
     uint32_t reserved2[5];
 } qcom_sbl1_header_t;
 
+enum {
+    BOOTIMG_SCAN_NONE,
+    BOOTIMG_SCAN_ANDROID,
+    BOOTIMG_SCAN_SBL1,
+    BOOTIMG_SCAN_ELF32,
+    BOOTIMG_SCAN_ELF64,
+    BOOTIMG_SCAN_MBN,
+};
+
+// what findbootimages detected on a partition
+typedef struct {
+    bool valid;
+    uint8_t type;
+    union {
+        struct {
+            uint32_t kernel_addr;
+            uint32_t kernel_size;
+            uint32_t ramdisk_addr;
+            uint32_t ramdisk_size;
+            uint32_t second_addr;
+            uint32_t second_size;
+            uint32_t tags_addr;
+            uint32_t dt_size;
+            uint32_t page_size;
+        } android;
+        qcom_sbl1_header_t sbl1;
+        qcom_bootimg_t mbn;
+        uint64_t entry;
+    } u;
+} bootimg_scan_t;
+
+// indexed like the partition table, entries stay valid until the
+// partition gets flashed or erased
+static bootimg_scan_t *bootimg_scan_table = NULL;
+static unsigned bootimg_scan_count = 0;
+
+// invalidates the scan result of a partition, or all of them for NULL
+// and names which aren't in the partition table
+static void bootimg_scan_invalidate(const char *name)
+{
+    int index = name ? partition_get_index(name) : -1;
+
+    if (index >= 0 && (unsigned)index < bootimg_scan_count)
+        bootimg_scan_table[index].valid = false;
+    else if (bootimg_scan_table)
+        memset(bootimg_scan_table, 0, bootimg_scan_count * sizeof(*bootimg_scan_table));
+}
+
+static void bootimg_scan_parse(bootimg_scan_t *scan, void *buf, uint64_t partsize)
+{
+    qcom_bootimg_t *bootimg = buf;
+    struct boot_img_hdr *aimg = buf;
+    qcom_sbl1_header_t *sbl1img = buf;
+    Elf32_Ehdr *elf32hdr = buf;
+    Elf64_Ehdr *elf64hdr = buf;
+
+    memset(scan, 0, sizeof(*scan));
+    scan->valid = true;
+
+    // android
+    if (!memcmp(aimg->magic, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
+        scan->type = BOOTIMG_SCAN_ANDROID;
+        scan->u.android.kernel_addr = aimg->kernel_addr;
+        scan->u.android.kernel_size = aimg->kernel_size;
+        scan->u.android.ramdisk_addr = aimg->ramdisk_addr;
+        scan->u.android.ramdisk_size = aimg->ramdisk_size;
+        scan->u.android.second_addr = aimg->second_addr;
+        scan->u.android.second_size = aimg->second_size;
+        scan->u.android.tags_addr = aimg->tags_addr;
+        scan->u.android.dt_size = aimg->dt_size;
+        scan->u.android.page_size = aimg->page_size;
+    }
+
+    // QCOM SBL1
+    else if (sbl1img->codeword==SBL1_CODEWORD && sbl1img->magic==SBL1_MAGIC) {
+        scan->type = BOOTIMG_SCAN_SBL1;
+        scan->u.sbl1 = *sbl1img;
+    }
+
+    // ELF32
+    else if (elf32hdr->e_ident[EI_CLASS] == ELFCLASS32) {
+        scan->type = BOOTIMG_SCAN_ELF32;
+        scan->u.entry = elf32hdr->e_entry;
+    }
+
+    // ELF64
+    else if (elf64hdr->e_ident[EI_CLASS] == ELFCLASS64) {
+        scan->type = BOOTIMG_SCAN_ELF64;
+        scan->u.entry = elf64hdr->e_entry;
+    }
+
+    // QCOM MBN
+    else if (bootimg->image_id<=0x7FFFFFFF && bootimg->image_size>0 && partsize >= bootimg->image_size &&
+             bootimg->image_size == (bootimg->code_size + bootimg->signature_size + bootimg->cert_chain_size)) {
+        scan->type = BOOTIMG_SCAN_MBN;
+        scan->u.mbn = *bootimg;
+    }
+}
+
+static void bootimg_scan_print(info_writer_t *info, const char *name, const bootimg_scan_t *scan)
+{
+    switch (scan->type) {
+        case BOOTIMG_SCAN_ANDROID:
+            info_writer_printf(info, "found Android image on %s", name);
+            info_writer_printf(info, "\tKernel: addr:%08x sz:%08x", scan->u.android.kernel_addr, scan->u.android.kernel_size);
+            info_writer_printf(info, "\tRamdisk: addr:%08x sz:%08x", scan->u.android.ramdisk_addr, scan->u.android.ramdisk_size);
+            info_writer_printf(info, "\tSecond: addr:%08x sz:%08x", scan->u.android.second_addr, scan->u.android.second_size);
+            info_writer_printf(info, "\tTags Addr:%08x, DTB sz:%08x", scan->u.android.tags_addr, scan->u.android.dt_size);
+            info_writer_printf(info, "\tpagesize:%u", scan->u.android.page_size);
+            break;
+
+        case BOOTIMG_SCAN_SBL1:
+            info_writer_printf(info, "found QCOM SBL1 image on %s", name);
+            info_writer_printf(info, "\tImage: src:%08x dst:%08x sz:%08x", scan->u.sbl1.image_src, scan->u.sbl1.image_dest_ptr, scan->u.sbl1.image_size);
+            info_writer_printf(info, "\tSignature: src:%08x sz:%08x", scan->u.sbl1.sig_ptr, scan->u.sbl1.sig_size);
+            info_writer_printf(info, "\tCERT chain: src:%08x sz:%08x", scan->u.sbl1.cert_chain_ptr, scan->u.sbl1.cert_chain_size);
+            info_writer_printf(info, "\tcode size: %08x", scan->u.sbl1.code_size);
+            info_writer_printf(info, "\tOEM root cert: sel:%08x num:%08x", scan->u.sbl1.oem_root_cert_sel, scan->u.sbl1.oem_num_root_certs);
+            break;
+
+        case BOOTIMG_SCAN_ELF32:
+            info_writer_printf(info, "found ELF32 image on %s", name);
+            info_writer_printf(info, "\tEntry: 0x%08x", (uint32_t)scan->u.entry);
+            break;
+
+        case BOOTIMG_SCAN_ELF64:
+            info_writer_printf(info, "found ELF64 image on %s", name);
+            info_writer_printf(info, "\tEntry: 0x%016llx", scan->u.entry);
+            break;
+
+        case BOOTIMG_SCAN_MBN:
+            info_writer_printf(info, "found QCOM MBN image on %s", name);
+            info_writer_printf(info, "\tID:%u(%s) version:%u", scan->u.mbn.image_id, qcombootimg2str(scan->u.mbn.image_id), scan->u.mbn.header_vsn_num);
+            info_writer_printf(info, "\tImage: src:%08x dst:%08x sz:%08x", scan->u.mbn.image_src, scan->u.mbn.image_dest_ptr, scan->u.mbn.image_size);
+            info_writer_printf(info, "\tSignature: src:%08x sz:%08x", scan->u.mbn.signature_ptr, scan->u.mbn.signature_size);
+            info_writer_printf(info, "\tCERT chain: src:%08x sz:%08x", scan->u.mbn.cert_chain_ptr, scan->u.mbn.cert_chain_size);
+            info_writer_printf(info, "\tcode size: %08x", scan->u.mbn.code_size);
+            break;
+    }
+}
+
 static void cmd_oem_findbootimages(const char *arg, void *data, unsigned sz)
 {
-    char buf[1024];
+    info_writer_t info;
     uint32_t readsize = 0;
+    unsigned i, j, n = 0;
     readsize = MAX(readsize, sizeof(qcom_bootimg_t));
     readsize = MAX(readsize, sizeof(boot_img_hdr));
     readsize = MAX(readsize, sizeof(qcom_sbl1_header_t));
@@ -359,127 +651,107 @@ static void cmd_oem_findbootimages(const char *arg, void *data, unsigned sz)
     readsize = MAX(readsize, sizeof(Elf64_Ehdr));
     readsize = ROUNDUP(readsize, mmc_get_device_blocksize());
 
+    // the table starts over if the partition table changed size
+    unsigned count = partition_get_count();
+    if (count != bootimg_scan_count) {
+        free(bootimg_scan_table);
+        bootimg_scan_table = calloc(count, sizeof(*bootimg_scan_table));
+        bootimg_scan_count = bootimg_scan_table ? count : 0;
+    }
+
     // allocate memory
     qcom_bootimg_t *bootimg = (qcom_bootimg_t *) memalign(CACHE_LINE, readsize);
-    if (!bootimg) {
+    unsigned *order = malloc(count * sizeof(*order));
+    if (!bootimg || !order || !bootimg_scan_table) {
+        free(bootimg);
+        free(order);
         fastboot_okay("error allocating memory");
         return;
     }
-    struct boot_img_hdr *aimg = (struct boot_img_hdr *)bootimg;
-    qcom_sbl1_header_t *sbl1img = (qcom_sbl1_header_t *)bootimg;
-    Elf32_Ehdr *elf32hdr = (Elf32_Ehdr *)bootimg;
-    Elf64_Ehdr *elf64hdr = (Elf64_Ehdr *)bootimg;
 
-    unsigned i = 0;
-    unsigned count = partition_get_count();
+    // partitions which weren't scanned yet, sorted by their start so the
+    // headers get read in a single pass over the device
     for (i = 0; i < count; i++) {
-        // get offset
         uint64_t offset = partition_get_offset(i);
-        if (!offset)
+        if (!offset || bootimg_scan_table[i].valid)
             continue;
 
-        // read
+        for (j = n; j > 0 && partition_get_offset(order[j - 1]) > offset; j--)
+            order[j] = order[j - 1];
+        order[j] = i;
+        n++;
+    }
+
+    for (j = 0; j < n; j++) {
+        i = order[j];
+
+        // partitions which can't hold a header are remembered as having
+        // none, read errors get retried next time
         uint64_t partsize = partition_get_size(i);
-        if (partsize<readsize)
+        if (partsize < readsize) {
+            memset(&bootimg_scan_table[i], 0, sizeof(bootimg_scan_table[i]));
+            bootimg_scan_table[i].valid = true;
             continue;
-
-        if (mmc_read(offset, (uint32_t *)bootimg, readsize))
+        }
+        if (mmc_read(partition_get_offset(i), (uint32_t *)bootimg, readsize))
             continue;
 
-
-        // android
-        if (!memcmp(aimg->magic, BOOT_MAGIC, BOOT_MAGIC_SIZE)) {
-            snprintf(buf, sizeof(buf), "found Android image on %s", partition_get_name(i));
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tKernel: addr:%08x sz:%08x", aimg->kernel_addr, aimg->kernel_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tRamdisk: addr:%08x sz:%08x", aimg->ramdisk_addr, aimg->ramdisk_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tSecond: addr:%08x sz:%08x", aimg->second_addr, aimg->second_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tTags Addr:%08x, DTB sz:%08x", aimg->tags_addr, aimg->dt_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tpagesize:%u", aimg->page_size);
-            fastboot_info(buf);
-        }
-
-        // QCOM SBL1
-        else if (sbl1img->codeword==SBL1_CODEWORD && sbl1img->magic==SBL1_MAGIC) {
-            snprintf(buf, sizeof(buf), "found QCOM SBL1 image on %s", partition_get_name(i));
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tImage: src:%08x dst:%08x sz:%08x", sbl1img->image_src, sbl1img->image_dest_ptr, sbl1img->image_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tSignature: src:%08x sz:%08x", sbl1img->sig_ptr, sbl1img->sig_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tCERT chain: src:%08x sz:%08x", sbl1img->cert_chain_ptr, sbl1img->cert_chain_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tcode size: %08x", sbl1img->code_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tOEM root cert: sel:%08x num:%08x", sbl1img->oem_root_cert_sel, sbl1img->oem_num_root_certs);
-            fastboot_info(buf);
-        }
-
-        // ELF32
-        else if (elf32hdr->e_ident[EI_CLASS] == ELFCLASS32) {
-            snprintf(buf, sizeof(buf), "found ELF32 image on %s", partition_get_name(i));
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tEntry: 0x%08x", elf32hdr->e_entry);
-            fastboot_info(buf);
-        }
-
-        // ELF64
-        else if (elf64hdr->e_ident[EI_CLASS] == ELFCLASS64) {
-            snprintf(buf, sizeof(buf), "found ELF64 image on %s", partition_get_name(i));
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tEntry: 0x%016llx", elf64hdr->e_entry);
-            fastboot_info(buf);
-        }
-
-        // QCOM MBN
-        else if (bootimg->image_id<=0x7FFFFFFF && bootimg->image_size>0 && partsize >= bootimg->image_size &&
-                 bootimg->image_size == (bootimg->code_size + bootimg->signature_size + bootimg->cert_chain_size)) {
-            snprintf(buf, sizeof(buf), "found QCOM MBN image on %s", partition_get_name(i));
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tID:%u(%s) version:%u", bootimg->image_id, qcombootimg2str(bootimg->image_id), bootimg->header_vsn_num);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tImage: src:%08x dst:%08x sz:%08x", bootimg->image_src, bootimg->image_dest_ptr, bootimg->image_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tSignature: src:%08x sz:%08x", bootimg->signature_ptr, bootimg->signature_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tCERT chain: src:%08x sz:%08x", bootimg->cert_chain_ptr, bootimg->cert_chain_size);
-            fastboot_info(buf);
-            snprintf(buf, sizeof(buf), "\tcode size: %08x", bootimg->code_size);
-            fastboot_info(buf);
-        }
+        bootimg_scan_parse(&bootimg_scan_table[i], bootimg, partsize);
     }
 
+    free(order);
     free(bootimg);
+
+    // the output stays in partition table order
+    info_writer_init(&info);
+    for (i = 0; i < count; i++) {
+        if (bootimg_scan_table[i].valid)
+            bootimg_scan_print(&info, partition_get_name(i), &bootimg_scan_table[i]);
+    }
+
+    info_writer_flush(&info);
     fastboot_okay("");
 }
 
-static void bio_foreach_cb(void *pdata, const char *name)
+// provided by aboot
+void cmd_flash(const char *arg, void *data, unsigned sz);
+void cmd_erase(const char *arg, void *data, unsigned sz);
+
+// these only drop cached information about the partition
+static void cmd_flash_invalidate(const char *arg, void *data, unsigned sz)
+{
+    bootimg_scan_invalidate(arg);
+    cmd_flash(arg, data, sz);
+}
+
+static void cmd_erase_invalidate(const char *arg, void *data, unsigned sz)
 {
-    char buf[1024];
+    bootimg_scan_invalidate(arg);
+    cmd_erase(arg, data, sz);
+}
 
+static void bio_foreach_cb(void *pdata, const char *name)
+{
     bdev_t *dev = bio_open(name);
     if (!dev) return;
 
-    snprintf(buf, sizeof(buf),
+    info_writer_printf(pdata,
              "%s(%s) sz:%lld bsz:%zd ref:%d sub:%d",
              dev->name, dev->label, dev->size, dev->block_size, dev->ref, dev->is_subdev
             );
-    fastboot_info(buf);
 }
 
 static void cmd_oem_dump_partitiontable(const char *arg, void *data, unsigned sz)
 {
-    char buf[1024];
+    info_writer_t info;
     unsigned i = 0;
     extern struct partition_entry *partition_entries;
 
+    info_writer_init(&info);
+
     if (!strcmp(arg, "qcom")) {
         for (i = 0; i < partition_get_count(); i++) {
-            snprintf(buf, sizeof(buf),
+            info_writer_printf(&info,
                      "%d: %s sz:%llu (%llu-%llu) type:%u",
                      i,
                      partition_entries[i].name,
@@ -488,174 +760,2484 @@ static void cmd_oem_dump_partitiontable(const char *arg, void *data, unsigned sz
                      partition_entries[i].last_lba,
                      partition_entries[i].dtype
                     );
-            fastboot_info(buf);
         }
     }
 
     else {
-        bio_foreach(bio_foreach_cb, NULL, true);
+        bio_foreach(bio_foreach_cb, &info, true);
     }
 
+    info_writer_flush(&info);
     fastboot_okay("");
 }
 
-#define PERSISTENT_RAM_SIG (0x43474244) /* DBGC */
-struct persistent_ram_buffer {
-    uint32_t    sig;
-    int    start;
-    int    size;
-    uint8_t     data[0];
-};
-
-static void cmd_oem_memfill(const char *arg, void *data, unsigned sz)
+// bytes per bio_read of the double-buffered reader
+#define BIO_READER_CHUNK_SIZE (4 * 1024 * 1024)
+
+/*
+ * Reads a range of a block device in its own thread into two alternating
+ * buffers, so the next chunk can be read while the caller is still busy
+ * with the previous one.
+ *
+ * bio_read polls and there's only one core, so the reader runs below the
+ * caller's priority and only gets the CPU while the caller blocks, e.g.
+ * on a USB transfer. CPU-bound callers like hashing would never let it
+ * run, they use sync mode and read the chunks themselves.
+ */
+typedef struct {
+    bdev_t *dev;
+    off_t offset;
+    off_t size;
+    size_t chunk_size;
+    // read in bio_reader_get instead of a thread
+    bool sync;
+
+    uint8_t *buf[2];
+    size_t len[2];
+    event_t filled[2];
+    event_t empty[2];
+    event_t finished;
+    volatile bool abort;
+    int rc;
+
+    // consumer side
+    unsigned cur;
+    off_t pos;
+    // time spent waiting for data in bio_reader_get
+    bigtime_t wait;
+} bio_reader_t;
+
+static int bio_reader_thread(void *arg)
 {
-    uint32_t i;
-    uint32_t testbase = hex2unsigned(arg);
-    arg += 9;
-    uint32_t length = hex2unsigned(arg);
-    for (i = 0; i < length; i++) {
-        *(volatile uint8_t *)(testbase + i) = 0xff;
+    bio_reader_t *reader = arg;
+    off_t pos = 0;
+    unsigned i = 0;
+
+    while (pos < reader->size) {
+        event_wait(&reader->empty[i]);
+        if (reader->abort)
+            break;
+
+        size_t len = MIN((off_t)reader->chunk_size, reader->size - pos);
+        if (bio_read(reader->dev, reader->buf[i], reader->offset + pos, len) != (ssize_t)len) {
+            reader->rc = -1;
+            reader->len[i] = 0;
+            event_signal(&reader->filled[i], true);
+            break;
+        }
+
+        reader->len[i] = len;
+        pos += len;
+        event_signal(&reader->filled[i], true);
+        i ^= 1;
     }
-    fastboot_okay("");
+
+    event_signal(&reader->finished, true);
+    return 0;
 }
 
-static void cmd_oem_lastkmsg(const char *arg, void *data, unsigned sz)
+// buf has to hold two chunks
+static int bio_reader_start(bio_reader_t *reader, bdev_t *dev, off_t offset, off_t size, void *buf, size_t chunk_size, bool sync)
 {
-    char buf[MAX_RSP_SIZE];
-    uint32_t addr;
+    unsigned i;
+
+    memset(reader, 0, sizeof(*reader));
+    reader->dev = dev;
+    reader->offset = offset;
+    reader->size = size;
+    reader->chunk_size = chunk_size;
+    reader->sync = sync;
+
+    for (i = 0; i < 2; i++) {
+        reader->buf[i] = (uint8_t *)buf + i * chunk_size;
+        event_init(&reader->filled[i], false, EVENT_FLAG_AUTOUNSIGNAL);
+        event_init(&reader->empty[i], true, EVENT_FLAG_AUTOUNSIGNAL);
+    }
+    event_init(&reader->finished, false, 0);
 
-#ifdef PERSISTENT_RAM_ADDR
-    addr = PERSISTENT_RAM_ADDR;
-#else
-    addr = hex2unsigned(arg);
-#endif
+    if (sync)
+        return 0;
 
-    struct persistent_ram_buffer *rambuf = (void *)addr;
-    if (rambuf->sig==PERSISTENT_RAM_SIG) {
-        snprintf(buf, sizeof(buf), "found last_kmsg at %p", rambuf);
-        fastboot_info(buf);
+    int priority = MAX(current_thread->priority - 1, LOWEST_PRIORITY);
+    thread_t *thread = thread_create("bio_reader", bio_reader_thread, reader, priority, DEFAULT_STACK_SIZE);
+    if (!thread)
+        return -1;
+    thread_resume(thread);
 
+    return 0;
+}
+
+// returns the next chunk or NULL at the end or after an error
+static uint8_t *bio_reader_get(bio_reader_t *reader, size_t *len)
+{
+    unsigned cur = reader->cur;
+
+    if (reader->pos >= reader->size)
+        return NULL;
 
-        uint8_t *data = &rambuf->data[0];
-        fastboot_send_string_human(data, rambuf->size);
+    bigtime_t t0 = current_time_hires();
+    if (reader->sync) {
+        size_t n = MIN((off_t)reader->chunk_size, reader->size - reader->pos);
+
+        reader->len[cur] = 0;
+        if (bio_read(reader->dev, reader->buf[cur], reader->offset + reader->pos, n) == (ssize_t)n)
+            reader->len[cur] = n;
+        else
+            reader->rc = -1;
     } else {
-        snprintf(buf, sizeof(buf), "last_kmsg not found at %p", rambuf);
-        fastboot_info(buf);
+        event_wait(&reader->filled[cur]);
     }
+    reader->wait += current_time_hires() - t0;
 
-    fastboot_okay("");
+    if (!reader->len[cur])
+        return NULL;
+
+    *len = reader->len[cur];
+    return reader->buf[cur];
 }
 
-#if defined(WITH_LIB_ATAGPARSE) && defined(WITH_LIB_BASE64)
-static void cmd_oem_dumpatags(const char *arg, void *data, unsigned sz)
+// hands the chunk returned by bio_reader_get back to the reader
+static void bio_reader_put(bio_reader_t *reader)
 {
-    void *tags = lkargs_get_tags_backup();
-    size_t tags_size = lkargs_get_tags_backup_size();
+    reader->pos += reader->len[reader->cur];
+    // no reschedule, the reader only runs once the caller blocks
+    if (!reader->sync)
+        event_signal(&reader->empty[reader->cur], false);
+    reader->cur ^= 1;
+}
 
-    if (tags && tags_size)
-        fastboot_send_buf(tags, tags_size);
+// stops the reader, returns 0 if everything got read successfully
+static int bio_reader_stop(bio_reader_t *reader)
+{
+    if (!reader->sync) {
+        reader->abort = true;
+        event_signal(&reader->empty[0], false);
+        event_signal(&reader->empty[1], false);
+        event_wait(&reader->finished);
+    }
 
-    fastboot_okay("");
+    if (reader->rc || reader->pos != reader->size)
+        return -1;
+    return 0;
 }
-#endif
 
-#if defined(WITH_LIB_BASE64)
-static void cmd_oem_dumpmem(const char *arg, void *data, unsigned sz)
+// opens a partition by its label or a device by its name
+static bdev_t *bio_open_any(const char *name)
 {
-    uint32_t addr = hex2unsigned(arg);
-    arg += 9;
-    uint32_t size = hex2unsigned(arg);
-
-    if (addr && size)
-        fastboot_send_buf((void *)addr, size);
+    bdev_t *dev = bio_open_by_label(name);
+    if (!dev)
+        dev = bio_open(name);
+    return dev;
+}
 
-    fastboot_okay("");
+// the largest chunk size for which two chunks fit into the download buffer
+static size_t bio_reader_chunk_size(bdev_t *dev)
+{
+    size_t chunk_size = MIN(BIO_READER_CHUNK_SIZE, target_get_max_flash_size() / 2);
+    return chunk_size - chunk_size % dev->block_size;
 }
-#endif
 
-#ifdef WITH_LIB_BOOT
-#define IS_ARM64(ptr) (((struct kernel64_hdr *)(ptr))->magic_64 == KERNEL64_HDR_MAGIC) ? true : false
+typedef struct {
+    bool sha256;
+#if defined(WITH_LIB_SHA256)
+    sha256_ctx_t sha;
+#endif
+    uint32_t crc;
+} hash_ctx_t;
 
-typedef void libboot_entry_func_ptr(unsigned, unsigned, unsigned);
-void libboot_platform_heap_init(void *base, size_t len);
-void target_uninit(void);
-void platform_uninit(void);
+static void hash_update(hash_ctx_t *ctx, const void *buf, size_t len)
+{
+#if defined(WITH_LIB_SHA256)
+    if (ctx->sha256) {
+        sha256_update(&ctx->sha, buf, len);
+        return;
+    }
+#endif
+#if defined(WITH_LIB_CRC32)
+    ctx->crc = crc32_update(ctx->crc, buf, len);
+#endif
+}
 
-static void boot_jump(bootimg_context_t *context)
+static void cmd_oem_hash(const char *arg, void *data, unsigned sz)
 {
-    void (*entry)(unsigned, unsigned, unsigned) = (libboot_entry_func_ptr *)(PA((addr_t)context->kernel_addr));
+    char words[3][32];
+    char tbuf[32];
+    info_writer_t info;
+    hash_ctx_t ctx;
+    unsigned count = 0;
+    uint64_t size;
+    bigtime_t t0, t1;
+
+    // oem hash <partition|AAAAAAAA SSSSSSSS> [crc32|sha256]
+    while (*arg && count < sizeof(words) / sizeof(words[0])) {
+        size_t len;
+
+        while (*arg == ' ')
+            arg++;
+        for (len = 0; arg[len] && arg[len] != ' '; len++);
+        if (!len)
+            break;
+
+        strlcpy(words[count++], arg, MIN(len + 1, sizeof(words[0])));
+        arg += len;
+    }
 
-    /* Perform target specific cleanup */
-    target_uninit();
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.sha256 = true;
+    if (count > 1 && !strcmp(words[count - 1], "crc32")) {
+        ctx.sha256 = false;
+        count--;
+    } else if (count > 1 && !strcmp(words[count - 1], "sha256")) {
+        count--;
+    }
 
-    /* Turn off splash screen if enabled */
-#if DISPLAY_SPLASH_SCREEN
-    target_display_shutdown();
+#if !defined(WITH_LIB_SHA256)
+    if (ctx.sha256) {
+        fastboot_fail("sha256 support missing");
+        return;
+    }
+#else
+    sha256_init(&ctx.sha);
+#endif
+#if !defined(WITH_LIB_CRC32)
+    if (!ctx.sha256) {
+        fastboot_fail("crc32 support missing");
+        return;
+    }
 #endif
 
-    dprintf(INFO, "booting linux @ %p, ramdisk @ %p (%lu), tags/device tree @ %p\n",
-            entry, (void *)context->ramdisk_addr, context->ramdisk_size, (void *)context->tags_addr);
+    if (count == 2) {
+        // a mistyped partition must not end up hashing memory at 0
+        if (!is_hex(words[0]) || !is_hex(words[1])) {
+            fastboot_fail("invalid arguments");
+            return;
+        }
 
-    enter_critical_section();
+        // memory doesn't need to be read, so it's hashed directly
+        uint8_t *addr = (uint8_t *)hex2unsigned(words[0]);
+        size = hex2unsigned(words[1]);
+
+        t0 = current_time_hires();
+        hash_update(&ctx, addr, size);
+        t1 = current_time_hires();
+    } else if (count == 1) {
+        bio_reader_t reader;
+        uint8_t *buf;
+        size_t len;
+
+        bdev_t *dev = bio_open_any(words[0]);
+        if (!dev) {
+            fastboot_fail("can't open partition");
+            return;
+        }
+        size = dev->size;
 
-    /* do any platform specific cleanup before kernel entry */
-    platform_uninit();
+        t0 = current_time_hires();
+        if (bio_reader_start(&reader, dev, 0, dev->size, data, bio_reader_chunk_size(dev), true)) {
+            bio_close(dev);
+            fastboot_fail("can't start reader");
+            return;
+        }
+        while ((buf = bio_reader_get(&reader, &len))) {
+            hash_update(&ctx, buf, len);
+            bio_reader_put(&reader);
+        }
+        int rc = bio_reader_stop(&reader);
+        t1 = current_time_hires();
 
-    arch_disable_cache(UCACHE);
+        bio_close(dev);
+        if (rc) {
+            fastboot_fail("read error");
+            return;
+        }
+    } else {
+        fastboot_fail("invalid arguments");
+        return;
+    }
 
-#if ARM_WITH_MMU
-    arch_disable_mmu();
+    info_writer_init(&info);
+#if defined(WITH_LIB_SHA256)
+    if (ctx.sha256) {
+        uint8_t digest[SHA256_DIGEST_SIZE];
+        char hex[SHA256_DIGEST_SIZE * 2 + 1];
+        unsigned i;
+
+        sha256_final(&ctx.sha, digest);
+        for (i = 0; i < SHA256_DIGEST_SIZE; i++)
+            snprintf(hex + i * 2, 3, "%02x", digest[i]);
+
+        // the digest doesn't fit into a single INFO line
+        info_writer_puts(&info, "sha256:");
+        info_writer_printf(&info, "%.32s", hex);
+        info_writer_printf(&info, "%.32s", hex + 32);
+    }
 #endif
-    bs_set_timestamp(BS_KERNEL_ENTRY);
+    if (!ctx.sha256)
+        info_writer_printf(&info, "crc32: %08x", ctx.crc);
 
-    if (IS_ARM64(context->kernel_addr))
-        // Jump to a 64bit kernel
-        scm_elexec_call((paddr_t)context->kernel_addr, context->kernel_arguments[2]);
-    else
-        // Jump to a 32bit kernel
-        entry(context->kernel_arguments[0], context->kernel_arguments[1], context->kernel_arguments[2]);
+    info_writer_printf(&info, "%llu bytes: %s", size, get_human_throughput(size, t1 - t0, tbuf, sizeof(tbuf)));
+    info_writer_flush(&info);
+    fastboot_okay("");
 }
 
-static void print_error_stack(void)
-{
-    // print errors
-    uint32_t i;
-    char **error_stack = libboot_error_stack_get();
-    for (i=0; i<libboot_error_stack_count(); i++)
-        printf("[%d] %s\n", i, error_stack[i]);
-    libboot_error_stack_reset();
-}
+#if defined(WITH_LIB_SHA256)
+// default size of the ranges in a block-sums manifest
+#define DELTA_RANGE_SIZE (1024 * 1024)
+// the manifest contains the first bytes of each range's sha256
+#define DELTA_DIGEST_SIZE 8
 
-static void update_ker_tags_rdisk_addr(bootimg_context_t *context, bool is_arm64)
+static void delta_emit_range(info_writer_t *info, sha256_ctx_t *sha, uint64_t offset)
 {
-    /* overwrite the destination of specified for the project */
-#ifdef ABOOT_IGNORE_BOOT_HEADER_ADDRS
-    if (is_arm64)
-        context->kernel_addr = ABOOT_FORCE_KERNEL64_ADDR;
-    else
-        context->kernel_addr = ABOOT_FORCE_KERNEL_ADDR;
-    context->ramdisk_addr = ABOOT_FORCE_RAMDISK_ADDR;
-    context->tags_addr = ABOOT_FORCE_TAGS_ADDR;
-#endif
+    uint8_t digest[SHA256_DIGEST_SIZE];
+    char hex[DELTA_DIGEST_SIZE * 2 + 1];
+    unsigned i;
+
+    sha256_final(sha, digest);
+    for (i = 0; i < DELTA_DIGEST_SIZE; i++)
+        snprintf(hex + i * 2, 3, "%02x", digest[i]);
+
+    info_writer_printf(info, "%llx %s", offset, hex);
+    sha256_init(sha);
 }
 
-static void *libboot_add_custom_atags(void *tags)
+static void cmd_oem_block_sums(const char *arg, void *data, unsigned sz)
 {
-    return lkargs_atag_insert_unknown(tags);
+    char words[3][32];
+    char tbuf[32];
+    info_writer_t info;
+    bio_reader_t reader;
+    sha256_ctx_t sha;
+    unsigned count = 0;
+    uint8_t *buf;
+    size_t len;
+
+    // oem block-sums <partition> [RANGESIZE] [LENGTH]
+    while (*arg && count < sizeof(words) / sizeof(words[0])) {
+        size_t wlen;
+
+        while (*arg == ' ')
+            arg++;
+        for (wlen = 0; arg[wlen] && arg[wlen] != ' '; wlen++);
+        if (!wlen)
+            break;
+
+        strlcpy(words[count++], arg, MIN(wlen + 1, sizeof(words[0])));
+        arg += wlen;
+    }
+    if (!count) {
+        fastboot_fail("invalid arguments");
+        return;
+    }
+
+    bdev_t *dev = bio_open_any(words[0]);
+    if (!dev) {
+        fastboot_fail("can't open partition");
+        return;
+    }
+
+    uint32_t range_size = count > 1 ? hex2unsigned(words[1]) : DELTA_RANGE_SIZE;
+    uint64_t length = count > 2 ? hex2u64(words[2]) : (uint64_t)dev->size;
+    if (!range_size || range_size % dev->block_size || length > (uint64_t)dev->size) {
+        bio_close(dev);
+        fastboot_fail("invalid range size or length");
+        return;
+    }
+
+    bigtime_t t0 = current_time_hires();
+    if (bio_reader_start(&reader, dev, 0, ROUNDUP(length, (uint64_t)dev->block_size), data, bio_reader_chunk_size(dev), true)) {
+        bio_close(dev);
+        fastboot_fail("can't start reader");
+        return;
+    }
+
+    info_writer_init(&info);
+    info_writer_printf(&info, "ranges %x %llx", range_size, length);
+
+    // ranges can span multiple chunks and the other way around
+    uint64_t pos = 0;
+    uint32_t filled = 0;
+    sha256_init(&sha);
+    while ((buf = bio_reader_get(&reader, &len))) {
+        size_t done = 0;
+
+        // the device is read in whole blocks, but only 'length' is hashed
+        len = MIN(len, length - pos);
+        while (done < len) {
+            size_t n = MIN(len - done, range_size - filled);
+
+            sha256_update(&sha, buf + done, n);
+            filled += n;
+            done += n;
+            pos += n;
+
+            if (filled == range_size || pos == length) {
+                delta_emit_range(&info, &sha, pos - filled);
+                filled = 0;
+            }
+        }
+
+        bio_reader_put(&reader);
+    }
+    int rc = bio_reader_stop(&reader);
+    bigtime_t t1 = current_time_hires();
+    bio_close(dev);
+
+    if (rc) {
+        info_writer_flush(&info);
+        fastboot_fail("read error");
+        return;
+    }
+
+    info_writer_printf(&info, "%llu bytes: %s", length, get_human_throughput(length, t1 - t0, tbuf, sizeof(tbuf)));
+    info_writer_flush(&info);
+    fastboot_okay("");
+}
+#endif
+
+#define DELTA_MAGIC 0x41544c44 // "DLTA"
+
+/*
+ * The payload of 'oem delta-write' as created by scripts/deltaflash.py,
+ * all values are little endian. The header is followed by 'count' ranges
+ * and the data of all ranges in the same order, starting at 'data_offset'.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t count;
+    uint32_t data_offset;
+    uint32_t reserved;
+} __attribute__((packed)) delta_header_t;
+
+typedef struct {
+    uint64_t offset;
+    uint32_t length;
+    uint32_t reserved;
+} __attribute__((packed)) delta_range_t;
+
+// writes 'len' bytes to a block aligned offset. A partial last block is
+// merged with what's on the device already.
+static int delta_write_range(bdev_t *dev, uint64_t offset, const uint8_t *src, size_t len, uint8_t *blockbuf)
+{
+    bnum_t block = offset / dev->block_size;
+    uint count = len / dev->block_size;
+    size_t tail = len % dev->block_size;
+
+    if (count && bio_write_block(dev, src, block, count) != (ssize_t)(count * dev->block_size))
+        return -1;
+
+    if (tail) {
+        if (bio_read_block(dev, blockbuf, block + count, 1) != (ssize_t)dev->block_size)
+            return -1;
+        memcpy(blockbuf, src + count * dev->block_size, tail);
+        if (bio_write_block(dev, blockbuf, block + count, 1) != (ssize_t)dev->block_size)
+            return -1;
+    }
+
+    return 0;
+}
+
+static void cmd_oem_delta_write(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    delta_header_t *hdr = data;
+    delta_range_t *ranges = (delta_range_t *)(hdr + 1);
+    uint64_t total = 0;
+    uint32_t i;
+    int rc = 0;
+
+    // oem delta-write <partition>, after downloading the payload
+    while (*arg == ' ')
+        arg++;
+
+    if (sz < sizeof(*hdr) || hdr->magic != DELTA_MAGIC
+        || hdr->count > (sz - sizeof(*hdr)) / sizeof(*ranges)
+        || hdr->data_offset < sizeof(*hdr) + hdr->count * sizeof(*ranges) || hdr->data_offset > sz) {
+        fastboot_fail("invalid payload");
+        return;
+    }
+
+    bdev_t *dev = bio_open_any(arg);
+    if (!dev) {
+        fastboot_fail("can't open partition");
+        return;
+    }
+
+    // validate everything before writing anything
+    for (i = 0; i < hdr->count; i++) {
+        delta_range_t *range = &ranges[i];
+
+        total += range->length;
+        // written so that huge offsets can't wrap around
+        if (range->offset % dev->block_size || range->offset > (uint64_t)dev->size
+            || range->length > (uint64_t)dev->size - range->offset
+            || (range->length % dev->block_size && i != hdr->count - 1)
+            || total > sz - hdr->data_offset) {
+            bio_close(dev);
+            fastboot_fail("invalid range");
+            return;
+        }
+    }
+
+    uint8_t *blockbuf = memalign(CACHE_LINE, dev->block_size);
+    if (!blockbuf) {
+        bio_close(dev);
+        fastboot_fail("can't allocate memory");
+        return;
+    }
+
+    bootimg_scan_invalidate(arg);
+
+    bigtime_t t0 = current_time_hires();
+    uint8_t *src = (uint8_t *)data + hdr->data_offset;
+    for (i = 0; i < hdr->count && !rc; i++) {
+        rc = delta_write_range(dev, ranges[i].offset, src, ranges[i].length, blockbuf);
+        src += ranges[i].length;
+    }
+    bigtime_t t1 = current_time_hires();
+
+    free(blockbuf);
+    bio_close(dev);
+
+    if (rc) {
+        snprintf(buf, sizeof(buf), "write error in range %u", i - 1);
+        fastboot_fail(buf);
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "%u ranges, %llu bytes: %s", hdr->count, total, get_human_throughput(total, t1 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+    fastboot_okay("");
+}
+
+// largest transfer size of the sweep, unless given
+#define BIO_BENCH_MAX_SIZE (4 * 1024 * 1024)
+// bytes transferred per measurement, within the request limits below
+#define BIO_BENCH_BYTES (32 * 1024 * 1024)
+#define BIO_BENCH_MIN_REQUESTS 8
+#define BIO_BENCH_MAX_REQUESTS 1024
+// all requests stay within this many bytes from the start
+#define BIO_BENCH_AREA (1024 * 1024 * 1024ULL)
+
+// comma separated labels of partitions which may be overwritten
+#ifndef BIO_BENCH_SCRATCH
+#define BIO_BENCH_SCRATCH "cache"
+#endif
+
+typedef struct {
+    // in 1/100 MB/s
+    uint32_t rate;
+    // per request, in usecs
+    uint32_t latency;
+} bio_bench_result_t;
+
+static bool bio_bench_is_scratch(const char *label)
+{
+    const char *p = BIO_BENCH_SCRATCH;
+    size_t len = strlen(label);
+
+    while (*p) {
+        if (!strncmp(p, label, len) && (p[len] == ',' || !p[len]))
+            return true;
+
+        p = strchr(p, ',');
+        if (!p)
+            break;
+        p++;
+    }
+
+    return false;
+}
+
+static int bio_bench_run(bdev_t *dev, uint8_t *buf, size_t size, uint64_t area, bool write, bool random, bio_bench_result_t *result)
+{
+    uint count = size / dev->block_size;
+    uint64_t slots = area / size;
+    unsigned requests = MIN(MAX(BIO_BENCH_BYTES / size, BIO_BENCH_MIN_REQUESTS), BIO_BENCH_MAX_REQUESTS);
+    unsigned i;
+
+    // sequential requests must not wrap around
+    if (!random)
+        requests = MIN(requests, slots);
+
+    bigtime_t t0 = current_time_hires();
+    for (i = 0; i < requests; i++) {
+        // rand() may only have 15 bits
+        uint64_t slot = random ? (((uint64_t)rand() << 30) ^ ((uint64_t)rand() << 15) ^ rand()) % slots : i;
+        bnum_t block = slot * count;
+        ssize_t ret;
+
+        if (write)
+            ret = bio_write_block(dev, buf, block, count);
+        else
+            ret = bio_read_block(dev, buf, block, count);
+        if (ret != (ssize_t)size)
+            return -1;
+    }
+    bigtime_t t1 = current_time_hires();
+
+    uint64_t usecs = MAX(t1 - t0, 1);
+    result->rate = (uint64_t)requests * size * 100 * 1000000 / (1024 * 1024) / usecs;
+    result->latency = usecs / requests;
+
+    return 0;
+}
+
+static void bio_bench_print(info_writer_t *info, size_t size, const bio_bench_result_t *seq, const bio_bench_result_t *rnd)
+{
+    char sizebuf[16];
+
+    if (size >= 1024 * 1024)
+        snprintf(sizebuf, sizeof(sizebuf), "%uM", (unsigned)(size / (1024 * 1024)));
+    else if (size >= 1024)
+        snprintf(sizebuf, sizeof(sizebuf), "%uK", (unsigned)(size / 1024));
+    else
+        snprintf(sizebuf, sizeof(sizebuf), "%u", (unsigned)size);
+
+    info_writer_printf(info, "%5s %6u.%02u %7u %6u.%02u %7u", sizebuf,
+                       seq->rate / 100, seq->rate % 100, seq->latency,
+                       rnd->rate / 100, rnd->rate % 100, rnd->latency);
+}
+
+static void cmd_oem_bio_bench(const char *arg, void *data, unsigned sz)
+{
+    char words[3][32];
+    info_writer_t info;
+    bio_bench_result_t seq, rnd;
+    unsigned count = 0;
+    unsigned i, pass;
+    bool rw = false;
+    size_t max_size = BIO_BENCH_MAX_SIZE;
+    size_t size;
+    int rc = 0;
+
+    // oem bio-bench <label> [rw] [CHUNK]
+    while (*arg && count < sizeof(words) / sizeof(words[0])) {
+        size_t len;
+
+        while (*arg == ' ')
+            arg++;
+        for (len = 0; arg[len] && arg[len] != ' '; len++);
+        if (!len)
+            break;
+
+        strlcpy(words[count++], arg, MIN(len + 1, sizeof(words[0])));
+        arg += len;
+    }
+    if (!count) {
+        fastboot_fail("invalid arguments");
+        return;
+    }
+    for (i = 1; i < count; i++) {
+        if (!strcmp(words[i], "rw"))
+            rw = true;
+        else
+            max_size = hex2unsigned(words[i]);
+    }
+
+    if (rw && !bio_bench_is_scratch(words[0])) {
+        fastboot_fail("writes are limited to " BIO_BENCH_SCRATCH);
+        return;
+    }
+
+    bdev_t *dev = bio_open_by_label(words[0]);
+    if (!dev) {
+        fastboot_fail("can't open partition");
+        return;
+    }
+
+    uint64_t area = MIN((uint64_t)dev->size, BIO_BENCH_AREA);
+    max_size = MIN(max_size, target_get_max_flash_size());
+    max_size = MIN(max_size, area);
+    max_size -= max_size % dev->block_size;
+    if (!max_size) {
+        bio_close(dev);
+        fastboot_fail("invalid chunk size");
+        return;
+    }
+
+    if (rw)
+        bootimg_scan_invalidate(words[0]);
+
+    // written data doesn't matter, but shouldn't be all zeros
+    memset(data, 0x5a, max_size);
+
+    info_writer_init(&info);
+    for (pass = 0; pass < (rw ? 2 : 1) && !rc; pass++) {
+        bool write = pass == 1;
+
+        info_writer_printf(&info, "%s: %s", write ? "write" : "read", dev->name);
+        info_writer_printf(&info, "%5s %9s %7s %9s %7s", "size", "seq", "lat", "random", "lat");
+        info_writer_printf(&info, "%5s %9s %7s %9s %7s", "", "MB/s", "usecs", "MB/s", "usecs");
+
+        // from a single block to the chunk size, in steps of 4
+        for (size = dev->block_size; ; size = MIN(size * 4, max_size)) {
+            rc = bio_bench_run(dev, data, size, area, write, false, &seq);
+            if (!rc)
+                rc = bio_bench_run(dev, data, size, area, write, true, &rnd);
+            if (rc)
+                break;
+
+            bio_bench_print(&info, size, &seq, &rnd);
+            if (size == max_size)
+                break;
+        }
+    }
+    bio_close(dev);
+
+    info_writer_flush(&info);
+    if (rc) {
+        fastboot_fail("i/o error");
+        return;
+    }
+    fastboot_okay("");
+}
+
+#define PERSISTENT_RAM_SIG (0x43474244) /* DBGC */
+struct persistent_ram_buffer {
+    uint32_t    sig;
+    int    start;
+    int    size;
+    uint8_t     data[0];
+};
+
+// fills memory with a 32bit pattern which is aligned to the address,
+// so every byte gets the same value no matter where the fill starts
+static void memfill_pattern(void *dst, uint32_t pattern, size_t len)
+{
+    uint8_t *p = dst;
+    uint64_t pattern64 = ((uint64_t)pattern << 32) | pattern;
+
+    while (len && ((addr_t)p & 15)) {
+        *p = pattern >> (((addr_t)p & 3) * 8);
+        p++;
+        len--;
+    }
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+    uint32x4_t v = vdupq_n_u32(pattern);
+    while (len >= 64) {
+        vst1q_u32((uint32_t *)p, v);
+        vst1q_u32((uint32_t *)(p + 16), v);
+        vst1q_u32((uint32_t *)(p + 32), v);
+        vst1q_u32((uint32_t *)(p + 48), v);
+        p += 64;
+        len -= 64;
+    }
+#endif
+
+    while (len >= 8) {
+        *(uint64_t *)p = pattern64;
+        p += 8;
+        len -= 8;
+    }
+
+    while (len) {
+        *p = pattern >> (((addr_t)p & 3) * 8);
+        p++;
+        len--;
+    }
+}
+
+static void cmd_oem_memfill(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    char words[3][16];
+    unsigned count = 0;
+    unsigned i;
+    uint32_t pattern = 0xffffffff;
+
+    // oem memfill AAAAAAAA SSSSSSSS [PPPPPPPP]
+    while (*arg) {
+        size_t len;
+
+        while (*arg == ' ')
+            arg++;
+        for (len = 0; arg[len] && arg[len] != ' '; len++);
+        if (!len)
+            break;
+
+        if (count == sizeof(words) / sizeof(words[0])) {
+            fastboot_fail("invalid arguments");
+            return;
+        }
+        strlcpy(words[count++], arg, MIN(len + 1, sizeof(words[0])));
+        arg += len;
+    }
+
+    // a typo must not fill memory with something else than asked for
+    for (i = 0; i < count; i++) {
+        if (!is_hex(words[i]))
+            break;
+    }
+    if (count < 2 || i < count) {
+        fastboot_fail("invalid arguments");
+        return;
+    }
+
+    uint32_t testbase = hex2unsigned(words[0]);
+    uint32_t length = hex2unsigned(words[1]);
+    if (count > 2)
+        pattern = hex2unsigned(words[2]);
+
+    bigtime_t t0 = current_time_hires();
+    memfill_pattern((void *)testbase, pattern, length);
+    // make sure it reaches the memory, this also makes the result a DRAM bandwidth
+    arch_clean_cache_range((addr_t)testbase, length);
+    bigtime_t t1 = current_time_hires();
+
+    snprintf(buf, sizeof(buf), "%u bytes: %s", length, get_human_throughput(length, t1 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+
+    fastboot_okay("");
+}
+
+#ifdef WITH_LIB_BOOT
+// libboot copies the kernel, ramdisk and tags through these, so use them
+// to get numbers which match the boot path
+void libboot_platform_memmove(void* dst, const void* src, boot_uintn_t num);
+void *libboot_platform_memset(void *s, int c, boot_uintn_t n);
+#define membench_copy libboot_platform_memmove
+#define membench_set libboot_platform_memset
+#else
+#define membench_copy memmove
+#define membench_set memset
+#endif
+
+#define MEMBENCH_MIN_SIZE (4 * 1024)
+#define MEMBENCH_MAX_SIZE (64 * 1024 * 1024)
+// the largest size tested without caches, everything is slow there anyway
+#define MEMBENCH_MAX_SIZE_UNCACHED (1024 * 1024)
+// one node per cache line for the latency test
+#define MEMBENCH_STRIDE 64
+
+static volatile uint64_t membench_sink;
+
+static uint64_t membench_read(const void *buf, size_t len)
+{
+    const uint64_t *p = buf;
+    const uint64_t *end = p + len / sizeof(uint64_t);
+    uint64_t a = 0, b = 0, c = 0, d = 0;
+
+    for (; p + 4 <= end; p += 4) {
+        a ^= p[0];
+        b ^= p[1];
+        c ^= p[2];
+        d ^= p[3];
+    }
+
+    return a ^ b ^ c ^ d;
+}
+
+// links all cache lines of buf into one cycle in random order,
+// so neither the prefetcher nor the TLB can help
+static void membench_chase_init(uint8_t *buf, size_t len, uint32_t *order)
+{
+    size_t n = len / MEMBENCH_STRIDE;
+    uint32_t seed = 0x12345678;
+    size_t i;
+
+    for (i = 0; i < n; i++)
+        order[i] = i;
+
+    for (i = n - 1; i > 0; i--) {
+        seed = seed * 1664525 + 1013904223;
+
+        size_t j = seed % (i + 1);
+        uint32_t tmp = order[i];
+        order[i] = order[j];
+        order[j] = tmp;
+    }
+
+    for (i = 0; i < n; i++)
+        *(void **)(buf + order[i] * MEMBENCH_STRIDE) = buf + order[(i + 1) % n] * MEMBENCH_STRIDE;
+}
+
+static void *membench_chase(void *p, unsigned steps)
+{
+    for (; steps >= 8; steps -= 8) {
+        p = *(void **)p;
+        p = *(void **)p;
+        p = *(void **)p;
+        p = *(void **)p;
+        p = *(void **)p;
+        p = *(void **)p;
+        p = *(void **)p;
+        p = *(void **)p;
+    }
+
+    while (steps--)
+        p = *(void **)p;
+
+    return p;
+}
+
+static uint32_t membench_mbps(uint64_t bytes, bigtime_t usecs)
+{
+    return usecs ? (uint32_t)(bytes * 1000000ULL / (1024 * 1024) / usecs) : 0;
+}
+
+typedef struct {
+    size_t size;
+    uint32_t copy;
+    uint32_t set;
+    uint32_t read;
+    uint32_t latency_ps;
+} membench_result_t;
+
+static void membench_run(uint8_t *buf, size_t size, uint32_t *order, uint64_t traffic, unsigned steps, membench_result_t *result)
+{
+    bigtime_t t0, t1;
+    unsigned i;
+
+    // repeat small sizes until enough data went through
+    unsigned iterations = MAX(1, (unsigned)(traffic / size));
+
+    result->size = size;
+
+    t0 = current_time_hires();
+    for (i = 0; i < iterations; i++)
+        membench_copy(buf + size, buf, size);
+    t1 = current_time_hires();
+    result->copy = membench_mbps((uint64_t)size * iterations, t1 - t0);
+
+    t0 = current_time_hires();
+    for (i = 0; i < iterations; i++)
+        membench_set(buf, i, size);
+    t1 = current_time_hires();
+    result->set = membench_mbps((uint64_t)size * iterations, t1 - t0);
+
+    t0 = current_time_hires();
+    for (i = 0; i < iterations; i++)
+        membench_sink += membench_read(buf, size);
+    t1 = current_time_hires();
+    result->read = membench_mbps((uint64_t)size * iterations, t1 - t0);
+
+    membench_chase_init(buf, size, order);
+    t0 = current_time_hires();
+    membench_sink += (addr_t)membench_chase(buf, steps);
+    t1 = current_time_hires();
+    result->latency_ps = (uint32_t)((t1 - t0) * 1000000ULL / steps);
+}
+
+static void membench_print(info_writer_t *info, const char *mode, const membench_result_t *result)
+{
+    char sizebuf[16];
+
+    if (result->size >= 1024 * 1024)
+        snprintf(sizebuf, sizeof(sizebuf), "%uM", (unsigned)(result->size / (1024 * 1024)));
+    else
+        snprintf(sizebuf, sizeof(sizebuf), "%uK", (unsigned)(result->size / 1024));
+
+    info_writer_printf(info, "%-8s %5s %6u %6u %6u %4u.%02u", mode, sizebuf,
+                       result->copy, result->set, result->read,
+                       result->latency_ps / 1000, (result->latency_ps % 1000) / 10);
+}
+
+static void cmd_oem_membench(const char *arg, void *data, unsigned sz)
+{
+    membench_result_t results[8];
+    info_writer_t info;
+    unsigned count, i;
+    uint8_t *buf = data;
+    size_t size, max_size;
+
+    // the download buffer holds the source, the destination and the chase order
+    max_size = MEMBENCH_MAX_SIZE;
+    while (max_size > MEMBENCH_MIN_SIZE && max_size * 2 + max_size / MEMBENCH_STRIDE * sizeof(uint32_t) > target_get_max_flash_size())
+        max_size /= 2;
+    uint32_t *order = (uint32_t *)(buf + max_size * 2);
+
+    info_writer_init(&info);
+    info_writer_puts(&info, "mode      size   copy    set   read  lat ns");
+    info_writer_puts(&info, "                 MB/s   MB/s   MB/s");
+
+    for (size = MEMBENCH_MIN_SIZE; size <= max_size; size *= 4) {
+        membench_run(buf, size, order, 64 * 1024 * 1024, 1 << 20, &results[0]);
+        membench_print(&info, "cached", &results[0]);
+    }
+    info_writer_flush(&info);
+
+    // there's no uncached mapping of DRAM, so run without the data cache.
+    // interrupts stay off meanwhile because exclusive accesses to uncached
+    // memory aren't supported everywhere, which also means the results
+    // can only be sent afterwards.
+    enter_critical_section();
+    arch_disable_cache(DCACHE);
+    count = 0;
+    for (size = MEMBENCH_MIN_SIZE; size <= MIN(max_size, MEMBENCH_MAX_SIZE_UNCACHED); size *= 4)
+        membench_run(buf, size, order, 4 * 1024 * 1024, 1 << 16, &results[count++]);
+    arch_enable_cache(DCACHE);
+    exit_critical_section();
+
+    for (i = 0; i < count; i++)
+        membench_print(&info, "uncached", &results[i]);
+
+    info_writer_flush(&info);
+    fastboot_okay("");
+}
+
+#define CACHEBENCH_MIN_SIZE (64 * 1024)
+#define CACHEBENCH_MAX_SIZE (64 * 1024 * 1024)
+
+// compares the set/way flush done by arch_disable_cache() to cleaning
+// only the dirty range by VA, for different amounts of dirty data
+static void cmd_oem_cache_bench(const char *arg, void *data, unsigned sz)
+{
+    info_writer_t info;
+    uint8_t *buf = data;
+    char sizebuf[16];
+    bigtime_t t0, t1;
+    uint32_t full, range;
+    size_t size;
+
+    info_writer_init(&info);
+    info_writer_printf(&info, "%5s %9s %9s", "dirty", "set/way", "by VA");
+    info_writer_printf(&info, "%5s %9s %9s", "", "usecs", "usecs");
+
+    for (size = CACHEBENCH_MIN_SIZE; size <= MIN(CACHEBENCH_MAX_SIZE, target_get_max_flash_size()); size *= 4) {
+        memset(buf, 0x5a, size);
+        enter_critical_section();
+        t0 = current_time_hires();
+        arch_disable_cache(DCACHE);
+        arch_enable_cache(DCACHE);
+        t1 = current_time_hires();
+        exit_critical_section();
+        full = t1 - t0;
+
+        memset(buf, 0xa5, size);
+        t0 = current_time_hires();
+        arch_clean_invalidate_cache_range((addr_t)buf, size);
+        t1 = current_time_hires();
+        range = t1 - t0;
+
+        if (size >= 1024 * 1024)
+            snprintf(sizebuf, sizeof(sizebuf), "%uM", (unsigned)(size / (1024 * 1024)));
+        else
+            snprintf(sizebuf, sizeof(sizebuf), "%uK", (unsigned)(size / 1024));
+
+        info_writer_printf(&info, "%5s %9u %9u", sizebuf, full, range);
+    }
+
+    info_writer_flush(&info);
+    fastboot_okay("");
+}
+
+// copies the newest len bytes of the ring in chronological order
+static void lastkmsg_linearize(struct persistent_ram_buffer *rambuf, uint8_t *out, unsigned len)
+{
+    unsigned size = rambuf->size;
+    unsigned first = (rambuf->start + size - len) % size;
+    unsigned len1 = MIN(len, size - first);
+
+    memcpy(out, &rambuf->data[first], len1);
+    memcpy(out + len1, &rambuf->data[0], len - len1);
+}
+
+static void cmd_oem_lastkmsg(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    uint32_t addr;
+
+#ifdef PERSISTENT_RAM_ADDR
+    addr = PERSISTENT_RAM_ADDR;
+#else
+    addr = hex2unsigned(arg);
+#endif
+
+    struct persistent_ram_buffer *rambuf = (void *)addr;
+    if (rambuf->sig != PERSISTENT_RAM_SIG) {
+        snprintf(buf, sizeof(buf), "last_kmsg not found at %p", rambuf);
+        fastboot_info(buf);
+    } else if (rambuf->size < 0 || rambuf->start < 0 || rambuf->start > rambuf->size ||
+               (unsigned)rambuf->size > target_get_max_flash_size()) {
+        // start is the next write position, the oldest byte once the ring wrapped
+        snprintf(buf, sizeof(buf), "invalid last_kmsg at %p", rambuf);
+        fastboot_info(buf);
+    } else {
+        snprintf(buf, sizeof(buf), "found last_kmsg at %p", rambuf);
+        fastboot_info(buf);
+
+        if (rambuf->size) {
+            lastkmsg_linearize(rambuf, data, rambuf->size);
+            fastboot_send_string_human(data, rambuf->size);
+        }
+    }
+
+    fastboot_okay("");
+}
+
+#if defined(WITH_LIB_BASE64)
+// raw bytes encoded per step
+#define DUMP_CHUNK_SIZE (16 * 1024)
+// base64 characters per INFO line, a multiple of 4 which fits into MAX_RSP_SIZE
+#define DUMP_LINE_SIZE  (((MAX_RSP_SIZE - 5) / 4) * 4)
+
+// encodes and sends data in fixed-size chunks, so memory usage doesn't depend on the dump size
+typedef struct {
+    b64_stream_t b64;
+#if defined(WITH_LIB_LZ4)
+    // optional compression before the encoding
+    lz4_stream_t *lz4;
+    uint8_t *lz4_buf;
+#endif
+    size_t len;
+    char buf[DUMP_LINE_SIZE + BASE64_STREAM_ENCODED_SIZE(DUMP_CHUNK_SIZE) + 1];
+} dump_stream_t;
+
+static void dump_stream_flush(dump_stream_t *stream, bool all)
+{
+    char line[DUMP_LINE_SIZE + 1];
+    size_t pos = 0;
+
+    while (stream->len - pos >= DUMP_LINE_SIZE || (all && pos < stream->len)) {
+        size_t n = MIN(stream->len - pos, DUMP_LINE_SIZE);
+
+        memcpy(line, stream->buf + pos, n);
+        line[n] = 0;
+        fastboot_info(line);
+
+        pos += n;
+    }
+
+    // keep the incomplete line for the next chunk
+    memmove(stream->buf, stream->buf + pos, stream->len - pos);
+    stream->len -= pos;
+}
+
+static void dump_stream_free(dump_stream_t *stream)
+{
+#if defined(WITH_LIB_LZ4)
+    free(stream->lz4);
+    free(stream->lz4_buf);
+#endif
+    free(stream);
+}
+
+static dump_stream_t *dump_stream_open(bool with_crc, bool with_lz4)
+{
+    dump_stream_t *stream = calloc(1, sizeof(dump_stream_t));
+    if (!stream)
+        return NULL;
+
+    if (with_crc)
+        b64_stream_init_crc32(&stream->b64);
+    else
+        b64_stream_init(&stream->b64);
+    stream->len = 0;
+
+#if defined(WITH_LIB_LZ4)
+    if (with_lz4) {
+        stream->lz4 = malloc(sizeof(lz4_stream_t));
+        stream->lz4_buf = malloc(LZ4_STREAM_BOUND(DUMP_CHUNK_SIZE));
+        if (!stream->lz4 || !stream->lz4_buf) {
+            dump_stream_free(stream);
+            return NULL;
+        }
+
+        lz4_stream_init(stream->lz4);
+    }
+#endif
+
+    return stream;
+}
+
+static void dump_stream_encode(dump_stream_t *stream, const void *buf, size_t len)
+{
+    const uint8_t *src = buf;
+
+    while (len) {
+        size_t n = MIN(len, DUMP_CHUNK_SIZE);
+
+        int rc = b64_stream_update(&stream->b64, src, n, stream->buf + stream->len, sizeof(stream->buf) - stream->len);
+        ASSERT(rc >= 0);
+        stream->len += rc;
+
+        dump_stream_flush(stream, false);
+
+        src += n;
+        len -= n;
+    }
+}
+
+static void dump_stream_write(dump_stream_t *stream, const void *buf, size_t len)
+{
+    const uint8_t *src = buf;
+
+    while (len) {
+        size_t n = MIN(len, DUMP_CHUNK_SIZE);
+
+#if defined(WITH_LIB_LZ4)
+        if (stream->lz4) {
+            int rc = lz4_stream_update(stream->lz4, src, n, stream->lz4_buf, LZ4_STREAM_BOUND(DUMP_CHUNK_SIZE));
+            ASSERT(rc >= 0);
+            dump_stream_encode(stream, stream->lz4_buf, rc);
+        } else
+#endif
+            dump_stream_encode(stream, src, n);
+
+        src += n;
+        len -= n;
+    }
+}
+
+static void dump_stream_close(dump_stream_t *stream)
+{
+#if defined(WITH_LIB_LZ4)
+    if (stream->lz4) {
+        int rc = lz4_stream_final(stream->lz4, stream->lz4_buf, LZ4_STREAM_BOUND(DUMP_CHUNK_SIZE));
+        ASSERT(rc >= 0);
+        dump_stream_encode(stream, stream->lz4_buf, rc);
+    }
+#endif
+
+    int rc = b64_stream_final(&stream->b64, stream->buf + stream->len, sizeof(stream->buf) - stream->len);
+    ASSERT(rc >= 0);
+    stream->len += rc;
+
+    dump_stream_flush(stream, true);
+
+    // the checksum goes into the last INFO line
+    if (stream->b64.with_crc) {
+        char buf[MAX_RSP_SIZE];
+        snprintf(buf, sizeof(buf), "crc32:%08x", b64_stream_crc32(&stream->b64));
+        fastboot_info(buf);
+    }
+
+    dump_stream_free(stream);
+}
+
+static int dump_stream_buf(const void *buf, size_t len, bool with_crc, bool with_lz4)
+{
+    dump_stream_t *stream = dump_stream_open(with_crc, with_lz4);
+    if (!stream)
+        return -1;
+
+    dump_stream_write(stream, buf, len);
+    dump_stream_close(stream);
+
+    return 0;
+}
+#endif
+
+#if defined(WITH_LIB_ATAGPARSE) && defined(WITH_LIB_BASE64)
+static void cmd_oem_dumpatags(const char *arg, void *data, unsigned sz)
+{
+    void *tags = lkargs_get_tags_backup();
+    size_t tags_size = lkargs_get_tags_backup_size();
+
+    while (*arg == ' ')
+        arg++;
+    bool lz4 = !strcmp(arg, "lz4");
+#if !defined(WITH_LIB_LZ4)
+    if (lz4) {
+        fastboot_fail("lz4 support missing");
+        return;
+    }
+#endif
+
+    if (tags && tags_size) {
+        if (dump_stream_buf(tags, tags_size, false, lz4)) {
+            fastboot_fail("error allocating memory");
+            return;
+        }
+    }
+
+    fastboot_okay("");
+}
+#endif
+
+#ifdef FASTBOOT_USB_RAW
+// provided by aboot, these transfer raw data over the fastboot endpoints.
+// stock aboot keeps usb_read/usb_write static, so everything needing a
+// data phase only gets built when the target's aboot exports them.
+int fastboot_usb_read(void *buf, unsigned len);
+int fastboot_usb_write(void *buf, unsigned len);
+
+// bytes per USB request, a multiple of the max packet size so only the last one can be short
+#define UPLOAD_CHUNK_SIZE (32 * 1024)
+
+// starts a device-to-host data phase, the host has to read exactly 'size' bytes.
+// the response is the same for host-to-device, which usb-bench relies on.
+static int upload_begin(uint32_t size)
+{
+    char buf[MAX_RSP_SIZE];
+
+    snprintf(buf, sizeof(buf), "DATA%08x", size);
+    if (fastboot_usb_write(buf, strlen(buf)) < 0)
+        return -1;
+
+    return 0;
+}
+
+static int upload_write(const void *buf, size_t len)
+{
+    const uint8_t *src = buf;
+    uint8_t *bounce = NULL;
+    int rc = 0;
+
+    while (len) {
+        size_t n = MIN(len, UPLOAD_CHUNK_SIZE);
+        void *chunk = (void *)src;
+
+        // the controller reads straight from memory, so unaligned
+        // sources have to go through a cache-line aligned copy
+        if ((addr_t)src & (CACHE_LINE - 1)) {
+            if (!bounce) {
+                bounce = memalign(CACHE_LINE, UPLOAD_CHUNK_SIZE);
+                if (!bounce) {
+                    rc = -1;
+                    break;
+                }
+            }
+
+            memcpy(bounce, src, n);
+            chunk = bounce;
+        }
+
+        if (fastboot_usb_write(chunk, n) != (int)n) {
+            rc = -1;
+            break;
+        }
+
+        src += n;
+        len -= n;
+    }
+
+    free(bounce);
+    return rc;
+}
+
+#if defined(WITH_LIB_LZ4)
+// compresses into dst, returns the frame size or -1 if it doesn't fit
+static int dump_compress(const void *src, size_t len, void *dst, size_t dstsize)
+{
+    const uint8_t *ip = src;
+    uint8_t *op = dst;
+    int rc = 0;
+
+    lz4_stream_t *lz4 = malloc(sizeof(lz4_stream_t));
+    if (!lz4)
+        return -1;
+    lz4_stream_init(lz4);
+
+    while (len) {
+        size_t n = MIN(len, LZ4_BLOCK_SIZE);
+
+        rc = lz4_stream_update(lz4, ip, n, op, dstsize - (op - (uint8_t *)dst));
+        if (rc < 0)
+            break;
+        op += rc;
+
+        ip += n;
+        len -= n;
+    }
+
+    if (rc >= 0) {
+        rc = lz4_stream_final(lz4, op, dstsize - (op - (uint8_t *)dst));
+        if (rc >= 0)
+            op += rc;
+    }
+
+    free(lz4);
+    return rc < 0 ? -1 : op - (uint8_t *)dst;
+}
+#endif
+
+static void cmd_oem_dumpmem_raw(uint32_t addr, uint32_t size, void *data, bool lz4)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    void *src = (void *)addr;
+    uint32_t len = size;
+
+    bigtime_t t0 = current_time_hires();
+#if defined(WITH_LIB_LZ4)
+    // the size has to be known before the data phase starts,
+    // so the frame gets built in the download buffer first
+    if (lz4) {
+        int rc = dump_compress(src, size, data, target_get_max_flash_size());
+        if (rc < 0) {
+            fastboot_fail("compressed data exceeds the download buffer");
+            return;
+        }
+
+        src = data;
+        len = rc;
+    }
+#endif
+    bigtime_t t1 = current_time_hires();
+
+    if (upload_begin(len) || upload_write(src, len)) {
+        fastboot_fail("usb transfer failed");
+        return;
+    }
+    bigtime_t t2 = current_time_hires();
+
+    if (lz4) {
+        snprintf(buf, sizeof(buf), "lz4: %u -> %u bytes, %s", size, len, get_human_throughput(size, t1 - t0, tbuf, sizeof(tbuf)));
+        fastboot_info(buf);
+    }
+
+    // the effective rate, including the compression
+    snprintf(buf, sizeof(buf), "%u bytes: %s", size, get_human_throughput(size, t2 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+
+    fastboot_okay("");
+}
+#endif
+
+#if defined(WITH_LIB_BASE64) || defined(FASTBOOT_USB_RAW)
+static void cmd_oem_dumpmem(const char *arg, void *data, unsigned sz)
+{
+    uint32_t addr = hex2unsigned(arg);
+    arg += 9;
+    uint32_t size = hex2unsigned(arg);
+    arg += 8;
+
+    // 'raw' skips base64 and sends the memory as a data phase,
+    // 'lz4' compresses it into an LZ4 frame first
+    bool raw = strstr(arg, " raw") != NULL;
+    bool lz4 = strstr(arg, " lz4") != NULL;
+
+#if !defined(WITH_LIB_LZ4)
+    if (lz4) {
+        fastboot_fail("lz4 support missing");
+        return;
+    }
+#endif
+
+    if (raw) {
+#ifdef FASTBOOT_USB_RAW
+        if (!size) {
+            fastboot_fail("invalid size");
+            return;
+        }
+
+        cmd_oem_dumpmem_raw(addr, size, data, lz4);
+#else
+        fastboot_fail("raw mode not supported");
+#endif
+        return;
+    }
+
+#if defined(WITH_LIB_BASE64)
+    if (addr && size) {
+        if (dump_stream_buf((void *)addr, size, true, lz4)) {
+            fastboot_fail("error allocating memory");
+            return;
+        }
+    }
+
+    fastboot_okay("");
+#else
+    fastboot_fail("base64 support missing, use raw mode");
+#endif
+}
+#endif
+
+#ifdef FASTBOOT_USB_RAW
+#if defined(WITH_LIB_LZ4)
+// compresses the first 'size' bytes the reader delivers into dst, returns
+// the frame size or -1 if it doesn't fit
+static int dump_partition_compress(bio_reader_t *reader, uint64_t size, void *dst, size_t dstsize)
+{
+    uint8_t *op = dst;
+    uint8_t *chunk;
+    uint64_t done = 0;
+    size_t len;
+    int rc = 0;
+
+    lz4_stream_t *lz4 = malloc(sizeof(lz4_stream_t));
+    if (!lz4)
+        return -1;
+    lz4_stream_init(lz4);
+
+    while (rc >= 0 && (chunk = bio_reader_get(reader, &len))) {
+        const uint8_t *ip = chunk;
+
+        len = MIN(len, size - done);
+        done += len;
+        while (len) {
+            size_t n = MIN(len, LZ4_BLOCK_SIZE);
+
+            rc = lz4_stream_update(lz4, ip, n, op, dstsize - (op - (uint8_t *)dst));
+            if (rc < 0)
+                break;
+            op += rc;
+
+            ip += n;
+            len -= n;
+        }
+
+        bio_reader_put(reader);
+    }
+
+    if (rc >= 0) {
+        rc = lz4_stream_final(lz4, op, dstsize - (op - (uint8_t *)dst));
+        if (rc >= 0)
+            op += rc;
+    }
+
+    free(lz4);
+    return rc < 0 ? -1 : op - (uint8_t *)dst;
+}
+#endif
+
+static void cmd_oem_dump_partition(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    char label[32];
+    char word[24];
+    bio_reader_t reader;
+    uint64_t numbers[2];
+    unsigned count = 0;
+    bool sync = false;
+    bool lz4 = false;
+    uint8_t *chunk;
+    size_t len;
+    int rc = 0;
+
+    // oem dump-partition <label> [OFFSET [SIZE]] [lz4] [sync], SIZE defaults
+    // to the rest. 'sync' reads without the reader thread, for comparison.
+    while (*arg == ' ')
+        arg++;
+    for (len = 0; arg[len] && arg[len] != ' '; len++);
+    strlcpy(label, arg, MIN(len + 1, sizeof(label)));
+    arg += len;
+
+    while (*arg) {
+        while (*arg == ' ')
+            arg++;
+        for (len = 0; arg[len] && arg[len] != ' '; len++);
+        if (!len)
+            break;
+
+        strlcpy(word, arg, MIN(len + 1, sizeof(word)));
+        if (!strcmp(word, "sync")) {
+            sync = true;
+        } else if (!strcmp(word, "lz4")) {
+            lz4 = true;
+        } else if (count == sizeof(numbers) / sizeof(numbers[0])) {
+            fastboot_fail("invalid arguments");
+            return;
+        } else {
+            numbers[count++] = hex2u64(word);
+        }
+
+        arg += len;
+    }
+
+#if !defined(WITH_LIB_LZ4)
+    if (lz4) {
+        fastboot_fail("lz4 support missing");
+        return;
+    }
+#endif
+
+    bdev_t *dev = bio_open_any(label);
+    if (!dev) {
+        fastboot_fail("can't open partition");
+        return;
+    }
+
+    uint64_t offset = count > 0 ? numbers[0] : 0;
+    if (offset % dev->block_size || offset >= (uint64_t)dev->size) {
+        bio_close(dev);
+        fastboot_fail("invalid range");
+        return;
+    }
+
+    uint64_t size = count > 1 ? numbers[1] : (uint64_t)dev->size - offset;
+    if (!size || size > (uint64_t)dev->size - offset) {
+        bio_close(dev);
+        fastboot_fail("invalid range");
+        return;
+    }
+    // that's all a data phase can announce, compressed frames are
+    // limited by the download buffer instead
+    if (size > 0xffffffff && !lz4) {
+        bio_close(dev);
+        fastboot_fail("too large, dump it in parts");
+        return;
+    }
+
+    // both halves of the download buffer are block aligned, so the
+    // controller can send them without a bounce buffer.
+    // compressing never blocks, so the reader thread couldn't run then.
+    size_t chunk_size = bio_reader_chunk_size(dev);
+    bigtime_t t0 = current_time_hires();
+    if (bio_reader_start(&reader, dev, offset, ROUNDUP(size, (uint64_t)dev->block_size), data, chunk_size, sync || lz4)) {
+        bio_close(dev);
+        fastboot_fail("can't start reader");
+        return;
+    }
+
+#if defined(WITH_LIB_LZ4)
+    // the size has to be known before the data phase starts, so the frame
+    // gets built in the download buffer behind the reader's chunks
+    if (lz4) {
+        uint8_t *frame = (uint8_t *)data + 2 * chunk_size;
+        int frame_size = dump_partition_compress(&reader, size, frame, target_get_max_flash_size() - 2 * chunk_size);
+        int read_rc = bio_reader_stop(&reader);
+        bigtime_t t1 = current_time_hires();
+        bio_close(dev);
+
+        // running out of space stops the reader early, so check that first
+        if (frame_size < 0) {
+            fastboot_fail("compressed data exceeds the download buffer");
+            return;
+        }
+        if (read_rc) {
+            fastboot_fail("read error");
+            return;
+        }
+
+        if (upload_begin(frame_size) || upload_write(frame, frame_size)) {
+            fastboot_fail("usb transfer failed");
+            return;
+        }
+        bigtime_t t2 = current_time_hires();
+
+        snprintf(buf, sizeof(buf), "lz4: %llu -> %u bytes, %s", size, frame_size, get_human_throughput(size, t1 - t0, tbuf, sizeof(tbuf)));
+        fastboot_info(buf);
+        snprintf(buf, sizeof(buf), "%llu bytes: %s", size, get_human_throughput(size, t2 - t0, tbuf, sizeof(tbuf)));
+        fastboot_info(buf);
+        fastboot_okay("");
+        return;
+    }
+#endif
+
+    if (upload_begin(size)) {
+        bio_reader_stop(&reader);
+        bio_close(dev);
+        fastboot_fail("usb transfer failed");
+        return;
+    }
+
+    // the next chunk gets read while this one is being sent
+    uint64_t sent = 0;
+    while ((chunk = bio_reader_get(&reader, &len))) {
+        len = MIN(len, size - sent);
+        rc = upload_write(chunk, len);
+        bio_reader_put(&reader);
+        if (rc)
+            break;
+        sent += len;
+    }
+    int read_rc = bio_reader_stop(&reader);
+    bigtime_t t1 = current_time_hires();
+    bio_close(dev);
+
+    if (rc) {
+        fastboot_fail("usb transfer failed");
+        return;
+    }
+
+    if (read_rc) {
+        // the data phase has to be completed before reporting the error
+        memset(data, 0, UPLOAD_CHUNK_SIZE);
+        while (sent < size && !rc) {
+            len = MIN(UPLOAD_CHUNK_SIZE, size - sent);
+            rc = upload_write(data, len);
+            sent += len;
+        }
+        fastboot_fail("read error");
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "%llu bytes: %s", size, get_human_throughput(size, t1 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+    // with overlapping reads this is roughly the time to read the first chunk
+    snprintf(buf, sizeof(buf), "%s: waited %llu of %llu ms for reads", sync ? "sync" : "threaded",
+             (uint64_t)reader.wait / 1000, (uint64_t)(t1 - t0) / 1000);
+    fastboot_info(buf);
+    fastboot_okay("");
+}
+
+static void cmd_oem_usb_bench(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    char mode[16];
+    size_t len;
+    uint32_t chunk = UPLOAD_CHUNK_SIZE;
+    uint32_t done = 0;
+    unsigned transfers = 0;
+    unsigned shorts = 0;
+
+    // oem usb-bench <sink|source> SSSSSSSS [CHUNK], followed by a data
+    // phase of that size. The default chunk size is the one downloads use.
+    while (*arg == ' ')
+        arg++;
+    for (len = 0; arg[len] && arg[len] != ' '; len++);
+    strlcpy(mode, arg, MIN(len + 1, sizeof(mode)));
+    arg += len;
+
+    while (*arg == ' ')
+        arg++;
+    uint32_t size = hex2unsigned(arg);
+    while (*arg && *arg != ' ')
+        arg++;
+    while (*arg == ' ')
+        arg++;
+    if (*arg)
+        chunk = hex2unsigned(arg);
+
+    bool sink = !strcmp(mode, "sink");
+    if (!sink && strcmp(mode, "source")) {
+        fastboot_fail("mode has to be sink or source");
+        return;
+    }
+    if (!size || !chunk || chunk > target_get_max_flash_size()) {
+        fastboot_fail("invalid size");
+        return;
+    }
+
+    // the data goes to or comes from the same buffer over and over again
+    if (!sink)
+        memset(data, 0x5a, chunk);
+
+    if (upload_begin(size)) {
+        fastboot_fail("usb transfer failed");
+        return;
+    }
+
+    // sources go through upload_write like the dump commands, which splits
+    // them into UPLOAD_CHUNK_SIZE requests and never returns short
+    bigtime_t t0 = current_time_hires();
+    while (done < size) {
+        uint32_t n = MIN(chunk, size - done);
+        int ret;
+
+        if (sink)
+            ret = fastboot_usb_read(data, n);
+        else
+            ret = upload_write(data, n) ? -1 : (int)n;
+
+        // the data phase can't be completed anymore
+        if (ret <= 0) {
+            fastboot_fail("usb transfer failed");
+            return;
+        }
+
+        transfers++;
+        if ((uint32_t)ret < n)
+            shorts++;
+        done += ret;
+    }
+    bigtime_t t1 = current_time_hires();
+
+    snprintf(buf, sizeof(buf), "%u bytes: %s", size, get_human_throughput(size, t1 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+    snprintf(buf, sizeof(buf), "%u transfers of %u bytes, %u short", transfers, chunk, shorts);
+    fastboot_info(buf);
+    fastboot_okay("");
+}
+#endif
+
+#if defined(WITH_LIB_CRC32) && (defined(WITH_LIB_BASE64) || defined(FASTBOOT_USB_RAW))
+#define RAMDUMP_MAGIC 0x504d4452 /* RDMP */
+#define RAMDUMP_MAX_REGIONS 32
+// bytes checksummed and sent per step
+#define RAMDUMP_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * The dump is a sequence of regions, each one is a header followed by
+ * the memory and the crc32 of that memory, all little-endian. Offsets for
+ * resuming refer to this sequence, not to physical addresses.
+ */
+typedef struct {
+    uint32_t magic;
+    uint32_t index;
+    uint64_t start;
+    uint64_t size;
+} __attribute__((packed)) ramdump_header_t;
+
+typedef struct {
+    uint64_t start;
+    uint64_t size;
+} ramdump_region_t;
+
+typedef struct {
+    // position in the dump
+    uint64_t pos;
+    // the host already has everything before this
+    uint64_t skip;
+#if defined(WITH_LIB_BASE64)
+    // base64 output, raw transfers use a data phase
+    dump_stream_t *stream;
+#endif
+    int rc;
+} ramdump_t;
+
+static void ramdump_add_region(ramdump_region_t *regions, unsigned *count, uint64_t start, uint64_t end)
+{
+    unsigned i;
+
+    if (start >= end || *count >= RAMDUMP_MAX_REGIONS)
+        return;
+
+    // keep them sorted by address
+    for (i = *count; i > 0 && regions[i - 1].start > start; i--)
+        regions[i] = regions[i - 1];
+
+    regions[i].start = start;
+    regions[i].size = end - start;
+    (*count)++;
+}
+
+static int ramdump_get_regions(ramdump_region_t *regions, unsigned *count)
+{
+    unsigned int i;
+    ram_partition ptn_entry;
+    uint64_t lk_start = MEMBASE;
+    uint64_t lk_end = MEMBASE + MEMSIZE;
+
+    if (!smem_ram_ptable_init_v1())
+        return -1;
+
+    *count = 0;
+    for (i = 0; i < smem_get_ram_ptable_len(); i++) {
+        smem_get_ram_ptable_entry(&ptn_entry, i);
+
+        // only DDR which is used by the HLOS is interesting
+        if (ptn_entry.category != SDRAM || ptn_entry.type != SYS_MEMORY)
+            continue;
+
+        // we can't access anything above 4GB
+        uint64_t start = ptn_entry.start;
+        uint64_t end = MIN(ptn_entry.start + ptn_entry.size, 0x100000000ULL);
+
+        // leave out LK itself
+        if (start < lk_end && end > lk_start) {
+            ramdump_add_region(regions, count, start, lk_start);
+            ramdump_add_region(regions, count, lk_end, end);
+        } else {
+            ramdump_add_region(regions, count, start, end);
+        }
+    }
+
+    return 0;
+}
+
+static void ramdump_emit(ramdump_t *dump, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+
+    if (dump->rc)
+        return;
+
+    if (dump->pos < dump->skip) {
+        size_t n = MIN(len, dump->skip - dump->pos);
+
+        dump->pos += n;
+        p += n;
+        len -= n;
+    }
+
+    if (!len)
+        return;
+
+#if defined(WITH_LIB_BASE64)
+    if (dump->stream) {
+        dump_stream_write(dump->stream, p, len);
+        dump->pos += len;
+        return;
+    }
+#endif
+#ifdef FASTBOOT_USB_RAW
+    dump->rc = upload_write(p, len);
+#endif
+
+    dump->pos += len;
+}
+
+static void ramdump_region(ramdump_t *dump, unsigned index, const ramdump_region_t *region)
+{
+    ramdump_header_t hdr;
+    uint32_t crc = 0;
+    uint64_t off;
+
+    uint64_t region_len = sizeof(hdr) + region->size + sizeof(crc);
+
+    // skip regions the host already has completely
+    if (dump->pos + region_len <= dump->skip) {
+        dump->pos += region_len;
+        return;
+    }
+
+    hdr.magic = RAMDUMP_MAGIC;
+    hdr.index = index;
+    hdr.start = region->start;
+    hdr.size = region->size;
+    ramdump_emit(dump, &hdr, sizeof(hdr));
+
+    for (off = 0; off < region->size && !dump->rc; off += RAMDUMP_CHUNK_SIZE) {
+        const uint8_t *p = (const uint8_t *)(addr_t)(region->start + off);
+        size_t n = MIN(region->size - off, RAMDUMP_CHUNK_SIZE);
+
+        // the checksum always covers the whole region, even when resuming
+        crc = crc32_update(crc, p, n);
+        ramdump_emit(dump, p, n);
+    }
+
+    ramdump_emit(dump, &crc, sizeof(crc));
+}
+
+static void cmd_oem_ramdump(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    char word[24];
+    ramdump_region_t regions[RAMDUMP_MAX_REGIONS];
+    info_writer_t info;
+    unsigned count, i;
+    ramdump_t dump = {0};
+    uint64_t total = 0;
+    bool raw = false;
+    bool lz4 = false;
+
+    // oem ramdump [OFFSET] [raw] [lz4]
+    while (*arg) {
+        size_t len;
+
+        while (*arg == ' ')
+            arg++;
+        for (len = 0; arg[len] && arg[len] != ' '; len++);
+        if (!len)
+            break;
+
+        strlcpy(word, arg, MIN(len + 1, sizeof(word)));
+        if (!strcmp(word, "raw")) {
+            raw = true;
+        } else if (!strcmp(word, "lz4")) {
+            lz4 = true;
+        } else if (is_hex(word)) {
+            dump.skip = hex2u64(word);
+        } else {
+            fastboot_fail("invalid arguments");
+            return;
+        }
+
+        arg += len;
+    }
+
+#if !defined(WITH_LIB_LZ4)
+    if (lz4) {
+        fastboot_fail("lz4 support missing");
+        return;
+    }
+#endif
+    if (raw && lz4) {
+        fastboot_fail("lz4 is only supported for base64 dumps");
+        return;
+    }
+#if !defined(WITH_LIB_BASE64)
+    if (!raw) {
+        fastboot_fail("base64 support missing, use raw mode");
+        return;
+    }
+#endif
+#ifndef FASTBOOT_USB_RAW
+    if (raw) {
+        fastboot_fail("raw mode not supported");
+        return;
+    }
+#endif
+
+    if (ramdump_get_regions(regions, &count)) {
+        fastboot_fail("error reading RAM ptable");
+        return;
+    }
+
+    info_writer_init(&info);
+    for (i = 0; i < count; i++) {
+        total += sizeof(ramdump_header_t) + regions[i].size + sizeof(uint32_t);
+        info_writer_printf(&info, "region %u: 0x%08llx-0x%08llx", i, regions[i].start, regions[i].start + regions[i].size);
+    }
+    info_writer_printf(&info, "ramdump: %llu bytes from offset %llu", total, dump.skip);
+
+    // the summary has to arrive before the dump starts
+    info_writer_flush(&info);
+
+    if (dump.skip >= total) {
+        fastboot_fail("offset exceeds the dump size");
+        return;
+    }
+    if (raw && total - dump.skip > 0xffffffffULL) {
+        fastboot_fail("dump too big for a data phase");
+        return;
+    }
+
+    bigtime_t t0 = current_time_hires();
+#ifdef FASTBOOT_USB_RAW
+    if (raw)
+        dump.rc = upload_begin(total - dump.skip);
+#endif
+#if defined(WITH_LIB_BASE64)
+    if (!raw) {
+        dump.stream = dump_stream_open(true, lz4);
+        if (!dump.stream) {
+            fastboot_fail("error allocating memory");
+            return;
+        }
+    }
+#endif
+
+    for (i = 0; i < count && !dump.rc; i++)
+        ramdump_region(&dump, i, &regions[i]);
+
+#if defined(WITH_LIB_BASE64)
+    if (dump.stream)
+        dump_stream_close(dump.stream);
+#endif
+    bigtime_t t1 = current_time_hires();
+
+    if (dump.rc) {
+        fastboot_fail("usb transfer failed");
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "%llu bytes: %s", total - dump.skip, get_human_throughput(total - dump.skip, t1 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+
+    fastboot_okay("");
+}
+#endif
+
+#if defined(WITH_LIB_BASE64)
+static void cmd_oem_base64_bench(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[2][32];
+    bigtime_t t0, t1, t2;
+    int rc_scalar, rc_simd;
+    uint32_t i;
+
+    // source, encoded output and decoded output share the download buffer
+    uint32_t size = 1024 * 1024;
+    while (*arg == ' ')
+        arg++;
+    if (*arg)
+        size = hex2unsigned(arg);
+    size = MIN(size, (uint32_t)(target_get_max_flash_size() / 5));
+
+    size_t encsize = BASE64_ENCODED_SIZE(size);
+    uint8_t *src = data;
+    char *enc_scalar = (char *)(src + size);
+    char *enc_simd = enc_scalar + encsize;
+    uint8_t *dec = (uint8_t *)(enc_simd + encsize);
+
+    // something that isn't trivially compressible
+    for (i = 0; i < size; i++)
+        src[i] = (uint8_t)((i * 2654435761U) >> 13);
+
+    t0 = current_time_hires();
+    rc_scalar = b64_ntop_scalar(src, size, enc_scalar, encsize);
+    t1 = current_time_hires();
+    rc_simd = b64_ntop(src, size, enc_simd, encsize);
+    t2 = current_time_hires();
+
+    if (rc_scalar < 0 || rc_scalar != rc_simd || memcmp(enc_scalar, enc_simd, rc_scalar)) {
+        fastboot_fail("encoder output mismatch");
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "ntop %u: %s -> %s", size,
+             get_human_throughput(size, t1 - t0, tbuf[0], sizeof(tbuf[0])),
+             get_human_throughput(size, t2 - t1, tbuf[1], sizeof(tbuf[1])));
+    fastboot_info(buf);
+
+    t0 = current_time_hires();
+    // the decoder needs room for one spare byte after padded input
+    rc_scalar = b64_pton_scalar(enc_scalar, dec, size + 2);
+    t1 = current_time_hires();
+    rc_simd = b64_pton(enc_simd, dec, size + 2);
+    t2 = current_time_hires();
+
+    if (rc_scalar != (int)size || rc_simd != (int)size || memcmp(src, dec, size)) {
+        fastboot_fail("decoder output mismatch");
+        return;
+    }
+
+    snprintf(buf, sizeof(buf), "pton %u: %s -> %s", size,
+             get_human_throughput(size, t1 - t0, tbuf[0], sizeof(tbuf[0])),
+             get_human_throughput(size, t2 - t1, tbuf[1], sizeof(tbuf[1])));
+    fastboot_info(buf);
+
+    fastboot_okay("");
+}
+#endif
+
+#ifdef WITH_LIB_BOOT
+#define IS_ARM64(ptr) (((struct kernel64_hdr *)(ptr))->magic_64 == KERNEL64_HDR_MAGIC) ? true : false
+
+typedef void libboot_entry_func_ptr(unsigned, unsigned, unsigned);
+void libboot_platform_heap_init(void *base, size_t len);
+size_t libboot_platform_heap_used(void);
+void libboot_platform_bootalloc_reset(void);
+int libboot_platform_bootalloc_foreach(void *pdata, void (*cb)(void *pdata, boot_uintn_t addr, boot_uintn_t sz));
+void target_uninit(void);
+void platform_uninit(void);
+
+// every phase is marked when it ends, so its duration is the time since
+// the previous mark
+enum {
+    BOOT_PHASE_START,
+    BOOT_PHASE_DOWNLOAD,
+    BOOT_PHASE_HEAP_INIT,
+    BOOT_PHASE_IDENTIFY,
+    BOOT_PHASE_LOAD,
+    BOOT_PHASE_PREPARE_TAGS,
+    BOOT_PHASE_PREPARE,
+    BOOT_PHASE_FASTBOOT_STOP,
+    BOOT_PHASE_TARGET_UNINIT,
+    BOOT_PHASE_DISPLAY_SHUTDOWN,
+    BOOT_PHASE_PLATFORM_UNINIT,
+    BOOT_PHASE_CACHE_DISABLE,
+    BOOT_PHASE_MMU_DISABLE,
+    BOOT_PHASE_JUMP,
+
+    BOOT_PHASE_COUNT,
+};
+
+static const char *boot_phase_names[BOOT_PHASE_COUNT] = {
+    [BOOT_PHASE_START] = "start",
+    [BOOT_PHASE_DOWNLOAD] = "download",
+    [BOOT_PHASE_HEAP_INIT] = "heap init",
+    [BOOT_PHASE_IDENTIFY] = "identify",
+    [BOOT_PHASE_LOAD] = "load",
+    [BOOT_PHASE_PREPARE_TAGS] = "prepare: tags",
+    [BOOT_PHASE_PREPARE] = "prepare: relocate",
+    [BOOT_PHASE_FASTBOOT_STOP] = "fastboot stop",
+    [BOOT_PHASE_TARGET_UNINIT] = "target uninit",
+    [BOOT_PHASE_DISPLAY_SHUTDOWN] = "display shutdown",
+    [BOOT_PHASE_PLATFORM_UNINIT] = "platform uninit",
+    [BOOT_PHASE_CACHE_DISABLE] = "cache disable",
+    [BOOT_PHASE_MMU_DISABLE] = "mmu disable",
+    [BOOT_PHASE_JUMP] = "jump",
+};
+
+#define BOOT_STATS_MAGIC 0x54534242 // "BBST"
+
+typedef struct {
+    uint32_t magic;
+    // bitmask of the recorded phases
+    uint32_t valid;
+    uint64_t base;
+    // relative to base
+    uint32_t usecs[BOOT_PHASE_COUNT];
+    // bytes cleaned by VA before the jump, 0 for a set/way flush
+    uint32_t cache_bytes;
+} boot_stats_t;
+
+// the stats of a successful boot can only be read after a reboot, so
+// targets can put them into memory which survives that
+#ifdef BOOT_STATS_ADDR
+#define boot_stats (*(boot_stats_t *)BOOT_STATS_ADDR)
+#else
+static boot_stats_t boot_stats;
+#endif
+
+static void boot_stats_reset(void)
+{
+    memset(&boot_stats, 0, sizeof(boot_stats));
+    boot_stats.magic = BOOT_STATS_MAGIC;
+    boot_stats.base = current_time_hires();
+    boot_stats.valid = (1 << BOOT_PHASE_START);
+}
+
+static void boot_stats_mark(unsigned phase)
+{
+    boot_stats.usecs[phase] = current_time_hires() - boot_stats.base;
+    boot_stats.valid |= (1 << phase);
+}
+
+#if DEVICE_TREE && defined(BOOT_STATS_IN_CHOSEN)
+#define BOOT_STATS_PROP "lk,boot-stats"
+
+// the property gets created with the right size while patching the fdt
+// so the final values can be written in place right before the jump
+static void boot_stats_update_fdt(void *fdt, bool create)
+{
+    uint32_t values[BOOT_PHASE_COUNT];
+    unsigned i;
+
+    if (fdt_check_header(fdt))
+        return;
+
+    int offset = fdt_path_offset(fdt, "/chosen");
+    if (offset < 0)
+        return;
+
+    // phases which didn't happen are 0
+    for (i = 0; i < BOOT_PHASE_COUNT; i++)
+        values[i] = cpu_to_fdt32(boot_stats.usecs[i]);
+
+    if (create)
+        fdt_setprop(fdt, offset, BOOT_STATS_PROP, values, sizeof(values));
+    else
+        fdt_setprop_inplace(fdt, offset, BOOT_STATS_PROP, values, sizeof(values));
+}
+#endif
+
+#if BOOT_CACHE_CLEAN_RANGES && defined(__arm__)
+// everything in the scratch region the boot wrote to
+static struct {
+    void *image;
+    size_t image_size;
+    void *heap;
+} boot_scratch;
+
+static void boot_clean_range(void *pdata, boot_uintn_t addr, boot_uintn_t sz)
+{
+    size_t *total = pdata;
+
+    arch_clean_invalidate_cache_range((addr_t)addr, sz);
+    *total += sz;
+}
+
+// cleans and invalidates everything which may be in the data cache by VA:
+// LK itself, the downloaded image, libboot's heap and the ranges libboot
+// loaded the kernel, ramdisk and tags to. Memory touched by earlier
+// commands like dump-mem isn't covered, so this is only safe for kernels
+// which invalidate their caches before enabling them.
+// returns the number of cleaned bytes or 0 if the ranges aren't known.
+static size_t boot_clean_ranges(void)
+{
+    size_t total = 0;
+
+    if (libboot_platform_bootalloc_foreach(&total, boot_clean_range) < 0)
+        return 0;
+
+    boot_clean_range(&total, MEMBASE, MEMSIZE);
+    boot_clean_range(&total, (boot_uintn_t)boot_scratch.image, boot_scratch.image_size);
+    boot_clean_range(&total, (boot_uintn_t)boot_scratch.heap, libboot_platform_heap_used());
+#ifdef BOOT_STATS_ADDR
+    boot_clean_range(&total, BOOT_STATS_ADDR, sizeof(boot_stats_t));
+#endif
+
+    return total;
+}
+
+// turns off the caches without a set/way flush. Only the stack gets
+// written after boot_clean_ranges(), so the part around sp is cleaned
+// right after the data cache got disabled, before it's accessed again.
+static void boot_disable_cache_noflush(void)
+{
+    __asm__ volatile(
+        "mrc p15, 0, r0, c1, c0, 0\n"
+        "bic r0, r0, #(1 << 2)\n"
+        "bic r0, r0, #(1 << 12)\n"
+        "mcr p15, 0, r0, c1, c0, 0\n"
+        "isb\n"
+        "sub r0, sp, #1024\n"
+        "bic r0, r0, %[mask]\n"
+        "add r1, sp, #1024\n"
+        "1:\n"
+        "mcr p15, 0, r0, c7, c14, 1\n"
+        "add r0, r0, %[line]\n"
+        "cmp r0, r1\n"
+        "blo 1b\n"
+        "dsb\n"
+        "mov r0, #0\n"
+        "mcr p15, 0, r0, c7, c5, 0\n"
+        "mcr p15, 0, r0, c7, c5, 6\n"
+        "dsb\n"
+        "isb\n"
+        :
+        : [mask] "I" (CACHE_LINE - 1), [line] "I" (CACHE_LINE)
+        : "r0", "r1", "cc", "memory");
+}
+#endif
+
+static void boot_jump(bootimg_context_t *context)
+{
+    void (*entry)(unsigned, unsigned, unsigned) = (libboot_entry_func_ptr *)(PA((addr_t)context->kernel_addr));
+
+    /* Perform target specific cleanup */
+    target_uninit();
+    boot_stats_mark(BOOT_PHASE_TARGET_UNINIT);
+
+    /* Turn off splash screen if enabled */
+#if DISPLAY_SPLASH_SCREEN
+    target_display_shutdown();
+    boot_stats_mark(BOOT_PHASE_DISPLAY_SHUTDOWN);
+#endif
+
+    dprintf(INFO, "booting linux @ %p, ramdisk @ %p (%lu), tags/device tree @ %p\n",
+            entry, (void *)context->ramdisk_addr, context->ramdisk_size, (void *)context->tags_addr);
+
+    enter_critical_section();
+
+    /* do any platform specific cleanup before kernel entry */
+    platform_uninit();
+    boot_stats_mark(BOOT_PHASE_PLATFORM_UNINIT);
+
+#if BOOT_CACHE_CLEAN_RANGES && defined(__arm__)
+    // nothing but the stack may be written between these two
+    size_t cache_bytes = boot_clean_ranges();
+    if (cache_bytes)
+        boot_disable_cache_noflush();
+    else
+        arch_disable_cache(UCACHE);
+    boot_stats.cache_bytes = cache_bytes;
+#else
+    arch_disable_cache(UCACHE);
+#endif
+    boot_stats_mark(BOOT_PHASE_CACHE_DISABLE);
+
+#if ARM_WITH_MMU
+    arch_disable_mmu();
+    boot_stats_mark(BOOT_PHASE_MMU_DISABLE);
+#endif
+    bs_set_timestamp(BS_KERNEL_ENTRY);
+    boot_stats_mark(BOOT_PHASE_JUMP);
+
+#if DEVICE_TREE && defined(BOOT_STATS_IN_CHOSEN)
+    // caches are off, so this goes straight to memory
+    boot_stats_update_fdt((void *)context->tags_addr, false);
+#endif
+
+    if (IS_ARM64(context->kernel_addr))
+        // Jump to a 64bit kernel
+        scm_elexec_call((paddr_t)context->kernel_addr, context->kernel_arguments[2]);
+    else
+        // Jump to a 32bit kernel
+        entry(context->kernel_arguments[0], context->kernel_arguments[1], context->kernel_arguments[2]);
+}
+
+static void print_error_stack(void)
+{
+    // print errors
+    uint32_t i;
+    char **error_stack = libboot_error_stack_get();
+    for (i=0; i<libboot_error_stack_count(); i++)
+        printf("[%d] %s\n", i, error_stack[i]);
+    libboot_error_stack_reset();
+}
+
+static void update_ker_tags_rdisk_addr(bootimg_context_t *context, bool is_arm64)
+{
+    /* overwrite the destination of specified for the project */
+#ifdef ABOOT_IGNORE_BOOT_HEADER_ADDRS
+    if (is_arm64)
+        context->kernel_addr = ABOOT_FORCE_KERNEL64_ADDR;
+    else
+        context->kernel_addr = ABOOT_FORCE_KERNEL_ADDR;
+    context->ramdisk_addr = ABOOT_FORCE_RAMDISK_ADDR;
+    context->tags_addr = ABOOT_FORCE_TAGS_ADDR;
+#endif
+}
+
+static void *libboot_add_custom_atags(void *tags)
+{
+    void *ret = lkargs_atag_insert_unknown(tags);
+    boot_stats_mark(BOOT_PHASE_PREPARE_TAGS);
+    return ret;
 }
 
 static void libboot_patch_fdt(void *fdt)
 {
 #if DEVICE_TREE
     lkargs_insert_chosen(fdt);
+#if defined(BOOT_STATS_IN_CHOSEN)
+    boot_stats_update_fdt(fdt, true);
+#endif
 #endif
+    boot_stats_mark(BOOT_PHASE_PREPARE_TAGS);
 }
 
-static void cmd_boot(const char *arg, void *data, unsigned sz)
+// arm64 kernels have to be placed at a 2MB aligned base plus text_offset
+#define BOOT_INPLACE_ARM64_ALIGN (2 * 1024 * 1024)
+// with AUTO_ZRELADDR a zImage gets decompressed into the 128MB window it
+// runs in, so it has to stay in the one of its load address
+#define BOOT_INPLACE_ZIMAGE_WINDOW (128 * 1024 * 1024)
+// what a zImage may use after its load address: the decompressed kernel
+// including bss and the decompressor, which moves itself behind that
+#define BOOT_INPLACE_ZIMAGE_FOOTPRINT (64 * 1024 * 1024)
+// upper bound for the tags or fdt libboot writes to tags_addr
+#define BOOT_INPLACE_TAGS_SIZE (1024 * 1024)
+
+static bool boot_ranges_overlap(addr_t a, size_t alen, addr_t b, size_t blen)
+{
+    return a < b + blen && b < a + alen;
+}
+
+// lets libboot_prepare skip the relocation of the kernel and the ramdisk
+// if they can be used at the place they were downloaded to, which are
+// left alone until the jump since libboot's heap starts behind them.
+// returns the number of bytes which don't have to be copied.
+static size_t boot_place_inplace(bootimg_context_t *context, void *image, unsigned size, void *end)
 {
+    addr_t image_start = (addr_t)image;
+    addr_t image_end = image_start + size;
+    addr_t kdata = (addr_t)context->kernel_data;
+    addr_t rdata = (addr_t)context->ramdisk_data;
+    addr_t kaddr = context->kernel_addr;
+    size_t kfootprint;
+    size_t saved = 0;
+
+    if (IS_ARM64(context->kernel_data)) {
+        struct kernel64_hdr *hdr = context->kernel_data;
+        // res2 is image_size, which includes bss and is 0 before 3.17
+        uint64_t text_offset = hdr->text_offset;
+        uint64_t image_size = hdr->res2;
+
+        kfootprint = image_size;
+        if (image_size && kdata >= image_start && kdata + context->kernel_size <= image_end
+            && kdata + image_size <= (addr_t)end
+            && ((kdata - text_offset) % BOOT_INPLACE_ARM64_ALIGN) == 0
+            && !boot_ranges_overlap(kdata, image_size, context->tags_addr, BOOT_INPLACE_TAGS_SIZE)
+            && !boot_ranges_overlap(kdata, image_size, context->ramdisk_addr, context->ramdisk_size)
+            && !boot_ranges_overlap(kdata, image_size, rdata, context->ramdisk_size))
+            kaddr = kdata;
+        else if (!image_size)
+            kfootprint = BOOT_INPLACE_ZIMAGE_FOOTPRINT;
+    } else {
+        kfootprint = BOOT_INPLACE_ZIMAGE_FOOTPRINT;
+        if (kdata >= image_start && kdata + context->kernel_size <= image_end && !(kdata & 3)
+            && (kdata & ~(BOOT_INPLACE_ZIMAGE_WINDOW - 1)) == (context->kernel_addr & ~(BOOT_INPLACE_ZIMAGE_WINDOW - 1))
+            && !boot_ranges_overlap(kdata, context->kernel_size, context->tags_addr, BOOT_INPLACE_TAGS_SIZE)
+            && !boot_ranges_overlap(kdata, context->kernel_size, context->ramdisk_addr, context->ramdisk_size)
+            && !boot_ranges_overlap(kdata, context->kernel_size, rdata, context->ramdisk_size))
+            kaddr = kdata;
+    }
+
+    if (kaddr != context->kernel_addr) {
+        context->kernel_addr = kaddr;
+        saved += context->kernel_size;
+    }
+
+    // the kernel doesn't care where the initrd is as long as nothing
+    // overwrites it before it got unpacked
+    if (context->ramdisk_size && rdata >= image_start && rdata + context->ramdisk_size <= image_end && !(rdata & 3)
+        && !boot_ranges_overlap(rdata, context->ramdisk_size, context->kernel_addr, kfootprint)
+        && !boot_ranges_overlap(rdata, context->ramdisk_size, context->tags_addr, BOOT_INPLACE_TAGS_SIZE)) {
+        context->ramdisk_addr = rdata;
+        saved += context->ramdisk_size;
+    }
+
+    return saved;
+}
+
+static void boot_memory(void *image, unsigned size, void *heap, size_t heapsize, bool inplace)
+{
+    char buf[MAX_RSP_SIZE];
+
     // init
-    libboot_platform_heap_init(data + sz, target_get_max_flash_size() - sz);
+    libboot_platform_heap_init(heap, heapsize);
+    libboot_platform_bootalloc_reset();
     libboot_init();
+#if BOOT_CACHE_CLEAN_RANGES && defined(__arm__)
+    boot_scratch.image = image;
+    boot_scratch.image_size = size;
+    boot_scratch.heap = heap;
+#endif
+    boot_stats_mark(BOOT_PHASE_HEAP_INIT);
 
     // setup context
     bootimg_context_t context;
@@ -664,17 +3246,33 @@ static void cmd_boot(const char *arg, void *data, unsigned sz)
     context.patch_fdt = libboot_patch_fdt;
 
     // identify type
-    int rc = libboot_identify_memory(data, sz, &context);
+    int rc = libboot_identify_memory(image, size, &context);
+    boot_stats_mark(BOOT_PHASE_IDENTIFY);
     if (!rc) {
         // load image
         rc = libboot_load(&context);
+        boot_stats_mark(BOOT_PHASE_LOAD);
         if (!rc) {
 
             // update loading addresses
             update_ker_tags_rdisk_addr(&context, IS_ARM64(context.kernel_data));
 
+            // boot from the download buffer if the layout allows it
+            if (inplace) {
+                addr_t kernel_addr = context.kernel_addr;
+                addr_t ramdisk_addr = context.ramdisk_addr;
+                size_t saved = boot_place_inplace(&context, image, size, (uint8_t *)heap + heapsize);
+
+                snprintf(buf, sizeof(buf), "in place: kernel %s, ramdisk %s, %u KB not copied",
+                         context.kernel_addr != kernel_addr ? "yes" : "no",
+                         context.ramdisk_addr != ramdisk_addr ? "yes" : "no",
+                         (unsigned)(saved / 1024));
+                fastboot_info(buf);
+            }
+
             // prepare for boot
             rc = libboot_prepare(&context);
+            boot_stats_mark(BOOT_PHASE_PREPARE);
             if (!rc) {
                 // just in case one got ignored
                 print_error_stack();
@@ -682,6 +3280,7 @@ static void cmd_boot(const char *arg, void *data, unsigned sz)
                 // disable fastboot
                 fastboot_okay("");
                 fastboot_stop();
+                boot_stats_mark(BOOT_PHASE_FASTBOOT_STOP);
 
                 // BOOT :)
                 boot_jump(&context);
@@ -699,6 +3298,339 @@ static void cmd_boot(const char *arg, void *data, unsigned sz)
 
     fastboot_fail("can't boot");
 }
+
+static void cmd_boot(const char *arg, void *data, unsigned sz)
+{
+    boot_stats_reset();
+    boot_memory(data, sz, data + sz, target_get_max_flash_size() - sz, false);
+}
+
+static void cmd_oem_boot_inplace(const char *arg, void *data, unsigned sz)
+{
+    boot_stats_reset();
+    boot_memory(data, sz, data + sz, target_get_max_flash_size() - sz, true);
+}
+
+// the size of an Android image according to its header, 0 for other formats
+static uint64_t boot_partition_image_size(const struct boot_img_hdr *hdr)
+{
+    uint64_t page_size = hdr->page_size;
+
+    if (memcmp(hdr->magic, BOOT_MAGIC, BOOT_MAGIC_SIZE) || !page_size)
+        return 0;
+
+    return page_size
+           + ROUNDUP((uint64_t)hdr->kernel_size, page_size)
+           + ROUNDUP((uint64_t)hdr->ramdisk_size, page_size)
+           + ROUNDUP((uint64_t)hdr->second_size, page_size)
+           + ROUNDUP((uint64_t)hdr->dt_size, page_size);
+}
+
+static void cmd_oem_boot_partition(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    uint8_t *image = data;
+    size_t max = target_get_max_flash_size();
+
+    // oem boot-partition <label>
+    while (*arg == ' ')
+        arg++;
+
+    bdev_t *dev = bio_open_any(arg);
+    if (!dev) {
+        fastboot_fail("can't open partition");
+        return;
+    }
+
+    boot_stats_reset();
+    bigtime_t t0 = current_time_hires();
+
+    // Android images declare their size, so the rest of the partition can
+    // be skipped. Everything else gets read completely.
+    size_t hdrsize = ROUNDUP(sizeof(struct boot_img_hdr), dev->block_size);
+    if (hdrsize > (uint64_t)dev->size || bio_read(dev, image, 0, hdrsize) != (ssize_t)hdrsize) {
+        bio_close(dev);
+        fastboot_fail("can't read header");
+        return;
+    }
+
+    uint64_t size = boot_partition_image_size((struct boot_img_hdr *)image);
+    if (!size)
+        size = dev->size;
+    if (size > (uint64_t)dev->size) {
+        bio_close(dev);
+        fastboot_fail("image exceeds the partition");
+        return;
+    }
+
+    // the rest in one large sequential read
+    uint64_t readsize = ROUNDUP(size, (uint64_t)dev->block_size);
+    if (readsize > max) {
+        bio_close(dev);
+        fastboot_fail("image exceeds the download buffer");
+        return;
+    }
+    if (readsize > hdrsize && bio_read(dev, image + hdrsize, hdrsize, readsize - hdrsize) != (ssize_t)(readsize - hdrsize)) {
+        bio_close(dev);
+        fastboot_fail("read error");
+        return;
+    }
+
+    bigtime_t t1 = current_time_hires();
+    boot_stats_mark(BOOT_PHASE_DOWNLOAD);
+    bio_close(dev);
+
+    snprintf(buf, sizeof(buf), "%llu bytes: %s", size, get_human_throughput(size, t1 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+
+    boot_memory(image, size, image + readsize, max - readsize, false);
+}
+
+#ifdef FASTBOOT_USB_RAW
+// bytes per USB read while streaming
+#define BOOT_STREAM_CHUNK_SIZE (1024 * 1024)
+// kept free for libboot's heap after the rebuilt image
+#define BOOT_STREAM_HEAP_SIZE (16 * 1024 * 1024)
+
+typedef struct {
+    uint8_t *buf;
+    uint32_t size;
+
+    // updated by the receiver thread
+    volatile uint32_t received;
+    volatile bool done;
+    volatile int rc;
+    event_t progress;
+    // the receiver doesn't touch the stream anymore after this
+    event_t finished;
+} boot_stream_t;
+
+static int boot_stream_receiver(void *arg)
+{
+    boot_stream_t *stream = arg;
+
+    while (stream->received < stream->size) {
+        uint32_t n = MIN(stream->size - stream->received, BOOT_STREAM_CHUNK_SIZE);
+
+        if (fastboot_usb_read(stream->buf + stream->received, n) != (int)n) {
+            stream->rc = -1;
+            break;
+        }
+
+        stream->received += n;
+        event_signal(&stream->progress, false);
+    }
+
+    stream->done = true;
+    event_signal(&stream->progress, false);
+    event_signal(&stream->finished, false);
+
+    return 0;
+}
+
+// waits until at least 'len' bytes arrived, returns false if that can't happen anymore
+static bool boot_stream_wait(boot_stream_t *stream, uint32_t len)
+{
+    while (stream->received < len && !stream->done)
+        event_wait(&stream->progress);
+
+    return stream->received >= len;
+}
+
+#if defined(WITH_LIB_ZLIB_INFLATE)
+/*
+ * Inflates a gzip compressed kernel of an Android image while the rest
+ * of it is still being received, and builds a copy of the image with the
+ * uncompressed kernel behind the download. Returns the size of that
+ * copy or 0 if the image has to be booted as it is.
+ */
+static uint32_t boot_stream_inflate(boot_stream_t *stream, uint8_t *out, size_t outsize)
+{
+    struct boot_img_hdr hdr;
+    z_stream strm;
+    int rc;
+
+    if (!boot_stream_wait(stream, sizeof(hdr)))
+        return 0;
+    memcpy(&hdr, stream->buf, sizeof(hdr));
+
+    if (memcmp(hdr.magic, BOOT_MAGIC, BOOT_MAGIC_SIZE) || !hdr.page_size)
+        return 0;
+
+    uint32_t page_size = hdr.page_size;
+    uint32_t kernel_start = page_size;
+    uint32_t kernel_end = kernel_start + hdr.kernel_size;
+    uint32_t rest_start = kernel_start + ROUNDUP(hdr.kernel_size, page_size);
+    if (rest_start > stream->size || rest_start < kernel_start)
+        return 0;
+    uint32_t rest_size = stream->size - rest_start;
+
+    if (page_size + rest_size + page_size >= outsize)
+        return 0;
+
+    // only gzip can be inflated on the fly
+    if (!boot_stream_wait(stream, kernel_start + 2))
+        return 0;
+    if (stream->buf[kernel_start] != 0x1f || stream->buf[kernel_start + 1] != 0x8b)
+        return 0;
+
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, 16 + MAX_WBITS) != Z_OK)
+        return 0;
+
+    strm.next_out = out + page_size;
+    strm.avail_out = outsize - page_size - rest_size - page_size;
+
+    uint32_t consumed = kernel_start;
+    rc = Z_OK;
+    while (rc != Z_STREAM_END && consumed < kernel_end) {
+        if (!boot_stream_wait(stream, consumed + 1))
+            break;
+
+        uint32_t avail = MIN(stream->received, kernel_end) - consumed;
+        strm.next_in = stream->buf + consumed;
+        strm.avail_in = avail;
+
+        rc = inflate(&strm, Z_NO_FLUSH);
+        consumed += avail - strm.avail_in;
+
+        if (rc != Z_OK && rc != Z_STREAM_END)
+            break;
+        if (rc == Z_OK && !strm.avail_out)
+            break;
+    }
+
+    uint32_t kernel_size = strm.total_out;
+    inflateEnd(&strm);
+
+    // trailing data like an appended DTB needs the original kernel
+    if (rc != Z_STREAM_END || consumed != kernel_end)
+        return 0;
+
+    // the header and everything after the kernel stay the same
+    if (!boot_stream_wait(stream, stream->size))
+        return 0;
+
+    hdr.kernel_size = kernel_size;
+    memset(out, 0, page_size);
+    memcpy(out, &hdr, sizeof(hdr));
+    memset(out + page_size + kernel_size, 0, ROUNDUP(kernel_size, page_size) - kernel_size);
+    memcpy(out + page_size + ROUNDUP(kernel_size, page_size), stream->buf + rest_start, rest_size);
+
+    return page_size + ROUNDUP(kernel_size, page_size) + rest_size;
+}
+#endif
+
+static void cmd_oem_boot_stream(const char *arg, void *data, unsigned sz)
+{
+    char buf[MAX_RSP_SIZE];
+    char tbuf[32];
+    boot_stream_t stream;
+    uint8_t *image = data;
+    uint32_t image_size = 0;
+
+    // oem boot-stream SSSSSSSS, followed by a download of that size
+    while (*arg == ' ')
+        arg++;
+    uint32_t size = hex2unsigned(arg);
+    if (!size || size > target_get_max_flash_size()) {
+        fastboot_fail("invalid size");
+        return;
+    }
+
+    boot_stats_reset();
+
+    memset(&stream, 0, sizeof(stream));
+    stream.buf = data;
+    stream.size = size;
+    event_init(&stream.progress, false, EVENT_FLAG_AUTOUNSIGNAL);
+    event_init(&stream.finished, false, 0);
+
+    snprintf(buf, sizeof(buf), "DATA%08x", size);
+    if (fastboot_usb_write(buf, strlen(buf)) < 0) {
+        fastboot_fail("usb transfer failed");
+        return;
+    }
+
+    // USB transfers happen in their own thread, so we can work on
+    // everything which already arrived
+    thread_t *thread = thread_create("boot_stream", boot_stream_receiver, &stream, HIGH_PRIORITY, DEFAULT_STACK_SIZE);
+    if (!thread) {
+        stream.done = true;
+        stream.rc = -1;
+        event_signal(&stream.finished, false);
+    } else {
+        thread_resume(thread);
+    }
+
+    bigtime_t t0 = current_time_hires();
+#if defined(WITH_LIB_ZLIB_INFLATE)
+    uint8_t *out = stream.buf + ROUNDUP(size, CACHE_LINE);
+    size_t outsize = target_get_max_flash_size() - ROUNDUP(size, CACHE_LINE);
+    if (outsize > BOOT_STREAM_HEAP_SIZE) {
+        image_size = boot_stream_inflate(&stream, out, outsize - BOOT_STREAM_HEAP_SIZE);
+        if (image_size)
+            image = out;
+    }
+#endif
+
+    // formats which need random access get booted once everything is there
+    event_wait(&stream.finished);
+    bigtime_t t1 = current_time_hires();
+    boot_stats_mark(BOOT_PHASE_DOWNLOAD);
+
+    if (stream.rc || stream.received != size) {
+        fastboot_fail("usb transfer failed");
+        return;
+    }
+
+    if (!image_size) {
+        image_size = size;
+        fastboot_info("streaming not supported for this image");
+    } else {
+        fastboot_info("kernel inflated during the download");
+    }
+
+    snprintf(buf, sizeof(buf), "%u bytes: %s", size, get_human_throughput(size, t1 - t0, tbuf, sizeof(tbuf)));
+    fastboot_info(buf);
+
+    boot_memory(image, image_size, image + image_size, target_get_max_flash_size() - (image + image_size - (uint8_t *)data), false);
+}
+#endif
+
+static void cmd_oem_boot_stats(const char *arg, void *data, unsigned sz)
+{
+    info_writer_t info;
+    uint32_t last = 0;
+    unsigned i;
+
+    if (boot_stats.magic != BOOT_STATS_MAGIC) {
+        fastboot_fail("no boot recorded");
+        return;
+    }
+
+    info_writer_init(&info);
+    info_writer_printf(&info, "%-18s %9s %9s", "phase", "usecs", "total");
+    for (i = 1; i < BOOT_PHASE_COUNT; i++) {
+        if (!(boot_stats.valid & (1 << i)))
+            continue;
+
+        uint32_t t = boot_stats.usecs[i];
+        info_writer_printf(&info, "%-18s %9u %9u", boot_phase_names[i], t - last, t);
+        last = t;
+    }
+
+    if (!(boot_stats.valid & (1 << BOOT_PHASE_JUMP)))
+        info_writer_puts(&info, "the kernel wasn't started");
+    else if (boot_stats.cache_bytes)
+        info_writer_printf(&info, "caches: %u KB cleaned by VA", boot_stats.cache_bytes / 1024);
+    else
+        info_writer_puts(&info, "caches: set/way flush");
+
+    info_writer_flush(&info);
+    fastboot_okay("");
+}
 #endif
 
 void aboot_fastboot_register_commands_ex(void)
@@ -717,23 +3649,53 @@ void aboot_fastboot_register_commands_ex(void)
         {"oem poweroff", cmd_poweroff},
 #if WITH_DEBUG_LOG_BUF
         {"oem lk_log", cmd_oem_lk_log},
+        {"oem lk_log-tail", cmd_oem_lk_log_tail},
 #endif
         {"oem ram-ptable", cmd_oem_ram_ptable},
         {"oem fbconfig", cmd_oem_fbconfig},
         {"oem bootaddresses", cmd_oem_bootaddresses},
         {"oem findbootimages", cmd_oem_findbootimages},
+        {"flash:", cmd_flash_invalidate},
+        {"erase:", cmd_erase_invalidate},
+#ifdef FASTBOOT_USB_RAW
+        // registered first, so dump-partitiontable gets checked before it
+        {"oem dump-partition", cmd_oem_dump_partition},
+#endif
         {"oem dump-partitiontable", cmd_oem_dump_partitiontable},
+        {"oem hash", cmd_oem_hash},
+#if defined(WITH_LIB_SHA256)
+        {"oem block-sums", cmd_oem_block_sums},
+#endif
+        {"oem delta-write", cmd_oem_delta_write},
+        {"oem bio-bench", cmd_oem_bio_bench},
         {"oem last_kmsg", cmd_oem_lastkmsg},
         {"oem memfill", cmd_oem_memfill},
+        {"oem membench", cmd_oem_membench},
+        {"oem cache-bench", cmd_oem_cache_bench},
 #if defined(WITH_LIB_ATAGPARSE) && defined(WITH_LIB_BASE64)
         {"oem dump-atags", cmd_oem_dumpatags},
 #endif
-#if defined(WITH_LIB_BASE64)
+#if defined(WITH_LIB_BASE64) || defined(FASTBOOT_USB_RAW)
         {"oem dump-mem", cmd_oem_dumpmem},
 #endif
+#ifdef FASTBOOT_USB_RAW
+        {"oem usb-bench", cmd_oem_usb_bench},
+#endif
+#if defined(WITH_LIB_CRC32) && (defined(WITH_LIB_BASE64) || defined(FASTBOOT_USB_RAW))
+        {"oem ramdump", cmd_oem_ramdump},
+#endif
+#if defined(WITH_LIB_BASE64)
+        {"oem base64-bench", cmd_oem_base64_bench},
+#endif
 
         // these work because fastboot checks the last commands first
 #ifdef WITH_LIB_BOOT
+        {"oem boot-inplace", cmd_oem_boot_inplace},
+        {"oem boot-partition", cmd_oem_boot_partition},
+        {"oem boot-stats", cmd_oem_boot_stats},
+#ifdef FASTBOOT_USB_RAW
+        {"oem boot-stream", cmd_oem_boot_stream},
+#endif
         {"boot", cmd_boot},
 #endif
 #endif
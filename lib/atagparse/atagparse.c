@@ -73,7 +73,7 @@ static size_t tags_size = 0;
 static qchwinfo_t* hwinfo_tags = NULL;
 static qchwinfo_t* hwinfo_lk = NULL;
 static char* command_line = NULL;
-static struct list_node cmdline_list;
+static cmdline_t cmdline_list;
 static lkargs_uefi_bootmode uefi_bootmode = LKARGS_UEFI_BM_NORMAL;
 static meminfo_t* meminfo = NULL;
 static size_t meminfo_count = 0;
@@ -116,7 +116,7 @@ const char* lkargs_get_command_line(void)
     return command_line;
 }
 
-struct list_node* lkargs_get_command_line_list(void)
+cmdline_t* lkargs_get_cmdline(void)
 {
     return &cmdline_list;
 }
@@ -1,4 +1,6 @@
 #include <err.h>
+#include <debug.h>
+#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -9,184 +11,709 @@ typedef struct cmdline_item {
     struct list_node node;
     char* name;
     char* value;
+    size_t name_len;
+    size_t value_len;
+
+    // position of this argument in the rendered command line
+    size_t offset;
+    // rendered length including the separating space
+    size_t span;
+    // set while cmdline_remove_prefix collects its victims
+    bool removed;
+    // hides the argument of the base list, not rendered
+    bool masked;
+    // rendered length of the base argument hidden by this item
+    size_t base_span;
+
+    // name and value are stored right behind the item
 } cmdline_item_t;
 
-static cmdline_item_t* cmdline_get_internal(struct list_node* list, const char* name)
+static int cmdline_item_cmp(const cmdline_item_t* item, const char* name, size_t name_len)
 {
-    cmdline_item_t *item;
-    list_for_every_entry(list, item, cmdline_item_t, node) {
-        if (!strcmp(name, item->name))
-            return item;
+    int rc = memcmp(item->name, name, MIN(item->name_len, name_len));
+    if (rc)
+        return rc;
+
+    if (item->name_len < name_len)
+        return -1;
+    if (item->name_len > name_len)
+        return 1;
+    return 0;
+}
+
+// returns the first index position whose name isn't smaller than name
+static size_t cmdline_index_lower_bound(cmdline_t* list, const char* name, size_t name_len)
+{
+    size_t lo = 0;
+    size_t hi = list->index_count;
+
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        if (cmdline_item_cmp(list->index[mid], name, name_len) < 0)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+// returns the index range [*plo, *phi) of all names starting with prefix
+static void cmdline_index_prefix_range(cmdline_t* list, const char* prefix, size_t* plo, size_t* phi)
+{
+    size_t prefix_len = strlen(prefix);
+    size_t lo = cmdline_index_lower_bound(list, prefix, prefix_len);
+    size_t hi = list->index_count;
+
+    // names with this prefix are sorted right behind the prefix itself
+    *plo = lo;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo)/2;
+        cmdline_item_t* item = list->index[mid];
+        if (item->name_len >= prefix_len && !memcmp(item->name, prefix, prefix_len))
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+    *phi = lo;
+}
+
+static int cmdline_index_insert(cmdline_t* list, size_t pos, cmdline_item_t* item)
+{
+    if (list->index_count == list->index_size) {
+        size_t newsize = list->index_size?list->index_size*2:16;
+        cmdline_item_t** index = realloc(list->index, newsize * sizeof(*index));
+        if (!index)
+            return -1;
+
+        list->index = index;
+        list->index_size = newsize;
     }
 
+    memmove(&list->index[pos + 1], &list->index[pos], (list->index_count - pos) * sizeof(*list->index));
+    list->index[pos] = item;
+    list->index_count++;
+
+    return 0;
+}
+
+static void cmdline_index_remove(cmdline_t* list, size_t lo, size_t hi)
+{
+    // the index is still NULL in lists which never had anything added
+    if (lo == hi)
+        return;
+
+    memmove(&list->index[lo], &list->index[hi], (list->index_count - hi) * sizeof(*list->index));
+    list->index_count -= hi - lo;
+}
+
+static cmdline_item_t* cmdline_get_internal_n(cmdline_t* list, const char* name, size_t name_len)
+{
+    size_t pos = cmdline_index_lower_bound(list, name, name_len);
+
+    if (pos < list->index_count && !cmdline_item_cmp(list->index[pos], name, name_len))
+        return list->index[pos];
+
     return NULL;
 }
 
-bool cmdline_has(struct list_node* list, const char* name)
+// values with whitespace have to be quoted to survive the next parser,
+// this has to use the same test as cmdline_next_token
+static bool cmdline_needs_quotes(const char* str, size_t len)
 {
-    return !!cmdline_get_internal(list, name);
+    size_t i;
+
+    for (i=0; i<len; i++) {
+        if (isspace((unsigned char)str[i]))
+            return true;
+    }
+
+    return false;
 }
 
-const char* cmdline_get(struct list_node* list, const char* name)
+// writes the argument followed by a space to dst, or just returns the length if dst is NULL
+static size_t cmdline_item_render(const cmdline_item_t* item, char* dst)
 {
-    cmdline_item_t* item = cmdline_get_internal(list, name);
+    size_t len = 0;
+    bool quote, quote_all;
 
-    if (!item)
-        return NULL;
+    if (item->value) {
+        // a name with whitespace only survives if the whole argument is quoted
+        quote_all = cmdline_needs_quotes(item->name, item->name_len);
+        quote = !quote_all && cmdline_needs_quotes(item->value, item->value_len);
 
-    return item->value;
+        if (quote_all) {
+            if (dst) dst[len] = '"';
+            len++;
+        }
+        if (dst) memcpy(dst+len, item->name, item->name_len);
+        len += item->name_len;
+        if (dst) dst[len] = '=';
+        len++;
+        if (quote) {
+            if (dst) dst[len] = '"';
+            len++;
+        }
+        if (dst) memcpy(dst+len, item->value, item->value_len);
+        len += item->value_len;
+        if (quote || quote_all) {
+            if (dst) dst[len] = '"';
+            len++;
+        }
+    }
+    else {
+        quote = cmdline_needs_quotes(item->name, item->name_len);
+
+        if (quote) {
+            if (dst) dst[len] = '"';
+            len++;
+        }
+        if (dst) memcpy(dst+len, item->name, item->name_len);
+        len += item->name_len;
+        if (quote) {
+            if (dst) dst[len] = '"';
+            len++;
+        }
+    }
+
+    if (dst) dst[len] = ' ';
+    len++;
+
+    return len;
 }
 
-void cmdline_add(struct list_node* list, const char* name, const char* value, bool overwrite)
+static int cmdline_rendered_reserve(cmdline_t* list, size_t size)
 {
-    cmdline_item_t* item = cmdline_get_internal(list, name);
-    if (item) {
-        if (!overwrite) return;
+    char* rendered;
+    size_t newsize;
 
-        list_delete(&item->node);
-        free(item->name);
-        free(item->value);
+    if (size <= list->rendered_size)
+        return 0;
+
+    newsize = list->rendered_size?:64;
+    while (newsize < size)
+        newsize *= 2;
+
+    rendered = realloc(list->rendered, newsize);
+    if (!rendered)
+        return -1;
+
+    list->rendered = rendered;
+    list->rendered_size = newsize;
+    return 0;
+}
+
+// O(n), every argument rendered behind the item moves
+static void cmdline_item_free(cmdline_t* list, cmdline_item_t* item)
+{
+    cmdline_item_t *next;
+    size_t pos = cmdline_index_lower_bound(list, item->name, item->name_len);
+
+    cmdline_index_remove(list, pos, pos + 1);
+
+    // the base argument becomes visible again
+    list->base_hidden_len -= item->base_span;
+
+    if (item->masked) {
         free(item);
+        return;
     }
 
-    item = malloc(sizeof(cmdline_item_t));
-    item->name = strdup(name);
-    item->value = value?strdup(value):NULL;
+    // cut the argument out of the rendered command line
+    memmove(list->rendered + item->offset, list->rendered + item->offset + item->span,
+            list->rendered_len - item->offset - item->span);
+    list->rendered_len -= item->span;
+
+    for (next = list_next_type(&list->items, &item->node, cmdline_item_t, node); next;
+            next = list_next_type(&list->items, &next->node, cmdline_item_t, node)) {
+        next->offset -= item->span;
+    }
 
-    list_add_tail(list, &item->node);
+    list_delete(&item->node);
+    free(item);
 }
 
-void cmdline_remove(struct list_node* list, const char* name)
+// masked items only exist in overlays and hide an argument of the base list.
+// they aren't rendered and only live in the index.
+static void cmdline_item_insert(cmdline_t* list, const char* name, size_t name_len,
+                                const char* value, size_t value_len, bool masked,
+                                const cmdline_item_t* base_item)
 {
-    cmdline_item_t* item = cmdline_get_internal(list, name);
-    if (item) {
-        list_delete(&item->node);
-        free(item->name);
-        free(item->value);
+    cmdline_item_t* item;
+    size_t pos = cmdline_index_lower_bound(list, name, name_len);
+
+    // one allocation for the item, the name and the value
+    item = malloc(sizeof(cmdline_item_t) + name_len + 1 + (value?value_len + 1:0));
+    if (!item) return;
+
+    item->name = (char*)(item + 1);
+    item->name_len = name_len;
+    memcpy(item->name, name, name_len);
+    item->name[name_len] = 0;
+
+    if (value) {
+        item->value = item->name + name_len + 1;
+        item->value_len = value_len;
+        memcpy(item->value, value, value_len);
+        item->value[value_len] = 0;
+    } else {
+        item->value = NULL;
+        item->value_len = 0;
+    }
+    item->removed = false;
+    item->masked = masked;
+    item->base_span = base_item?base_item->span:0;
+
+    if (masked) {
+        item->span = 0;
+        item->offset = 0;
+        if (cmdline_index_insert(list, pos, item)) {
+            free(item);
+            return;
+        }
+        list->base_hidden_len += item->base_span;
+        return;
+    }
+
+    // append it to the rendered command line
+    item->span = cmdline_item_render(item, NULL);
+    if (cmdline_rendered_reserve(list, list->rendered_len + item->span)
+            || cmdline_index_insert(list, pos, item)) {
         free(item);
+        return;
     }
+    item->offset = list->rendered_len;
+    cmdline_item_render(item, list->rendered + item->offset);
+    list->rendered_len += item->span;
+    list->base_hidden_len += item->base_span;
+
+    list_add_tail(&list->items, &item->node);
 }
 
-size_t cmdline_length(struct list_node* list)
+// returns the argument visible through list, following overlays into their base
+static cmdline_item_t* cmdline_lookup(cmdline_t* list, const char* name, size_t name_len)
 {
-    size_t len = 0;
+    cmdline_item_t* item = cmdline_get_internal_n(list, name, name_len);
 
-    cmdline_item_t *item;
-    list_for_every_entry(list, item, cmdline_item_t, node) {
-        // leading space
-        if (len!=0) len++;
-        // name
-        len+=strlen(item->name);
-        // '=' and value
-        if (item->value)
-            len+= 1 + strlen(item->value);
+    if (item)
+        return item->masked?NULL:item;
+
+    if (list->base)
+        return cmdline_get_internal_n(list->base, name, name_len);
+
+    return NULL;
+}
+
+static void cmdline_add_internal(cmdline_t* list, const char* name, size_t name_len,
+                                 const char* value, size_t value_len, bool overwrite)
+{
+    ASSERT(!list->overlays);
+
+    if (!overwrite && cmdline_lookup(list, name, name_len))
+        return;
+
+    cmdline_item_t* item = cmdline_get_internal_n(list, name, name_len);
+    if (item)
+        cmdline_item_free(list, item);
+
+    const cmdline_item_t* base_item = NULL;
+    if (list->base)
+        base_item = cmdline_get_internal_n(list->base, name, name_len);
+
+    cmdline_item_insert(list, name, name_len, value, value_len, false, base_item);
+}
+
+static void cmdline_remove_internal(cmdline_t* list, const char* name, size_t name_len)
+{
+    cmdline_item_t* item = cmdline_get_internal_n(list, name, name_len);
+    if (item) {
+        if (item->masked)
+            return;
+
+        cmdline_item_free(list, item);
+    }
+
+    // the base can't be modified, so hide its argument instead
+    if (list->base) {
+        const cmdline_item_t* base_item = cmdline_get_internal_n(list->base, name, name_len);
+        if (base_item)
+            cmdline_item_insert(list, name, name_len, NULL, 0, true, base_item);
+    }
+}
+
+bool cmdline_has(cmdline_t* list, const char* name)
+{
+    return !!cmdline_lookup(list, name, strlen(name));
+}
+
+const char* cmdline_get(cmdline_t* list, const char* name)
+{
+    cmdline_item_t* item = cmdline_lookup(list, name, strlen(name));
+
+    if (!item)
+        return NULL;
+
+    return item->value;
+}
+
+void cmdline_add(cmdline_t* list, const char* name, const char* value, bool overwrite)
+{
+    cmdline_add_internal(list, name, strlen(name), value, value?strlen(value):0, overwrite);
+}
+
+void cmdline_remove(cmdline_t* list, const char* name)
+{
+    ASSERT(!list->overlays);
+
+    cmdline_remove_internal(list, name, strlen(name));
+}
+
+void cmdline_find_prefix(cmdline_t* list, const char* prefix, cmdline_iter_t* iter)
+{
+    iter->list = list;
+    cmdline_index_prefix_range(list, prefix, &iter->pos, &iter->end);
+
+    if (list->base) {
+        cmdline_index_prefix_range(list->base, prefix, &iter->base_pos, &iter->base_end);
+    } else {
+        iter->base_pos = 0;
+        iter->base_end = 0;
     }
+}
 
-    // 0 terminator
-    if (len>0) len++;
+bool cmdline_iter_next(cmdline_iter_t* iter, const char** name, const char** value)
+{
+    cmdline_item_t* item;
+
+    for (;;) {
+        cmdline_item_t* own = NULL;
+        cmdline_item_t* base = NULL;
+
+        if (iter->pos < iter->end)
+            own = iter->list->index[iter->pos];
+        if (iter->base_pos < iter->base_end)
+            base = iter->list->base->index[iter->base_pos];
+
+        if (!own && !base)
+            return false;
+
+        // merge both sorted ranges, the overlay wins on equal names
+        if (own && base) {
+            int rc = cmdline_item_cmp(own, base->name, base->name_len);
+            if (rc == 0)
+                iter->base_pos++;
+            if (rc > 0)
+                own = NULL;
+        }
+
+        if (own) {
+            iter->pos++;
+            if (own->masked)
+                continue;
+            item = own;
+        } else {
+            iter->base_pos++;
+            item = base;
+        }
+
+        break;
+    }
+
+    *name = item->name;
+    if (value)
+        *value = item->value;
+
+    return true;
+}
+
+size_t cmdline_remove_prefix(cmdline_t* list, const char* prefix)
+{
+    size_t lo, hi, i;
+    size_t count = 0;
+    size_t shadowed = 0;
+    cmdline_item_t *item, *next;
+    cmdline_item_t *first = NULL;
+
+    ASSERT(!list->overlays);
+
+    cmdline_index_prefix_range(list, prefix, &lo, &hi);
+
+    // mark all victims and find the first one in the rendered command line
+    for (i = lo; i < hi; i++) {
+        item = list->index[i];
+        list->base_hidden_len -= item->base_span;
+
+        // the base argument it hides matches as well and is counted below
+        if (item->base_span)
+            shadowed++;
+
+        if (item->masked) {
+            free(item);
+            continue;
+        }
+
+        item->removed = true;
+        count++;
+        if (!first || item->offset < first->offset)
+            first = item;
+    }
+    cmdline_index_remove(list, lo, hi);
+
+    // compact the rendered command line in a single pass
+    if (first) {
+        size_t offset = first->offset;
+        for (item = first; item; item = next) {
+            next = list_next_type(&list->items, &item->node, cmdline_item_t, node);
+
+            if (item->removed) {
+                list_delete(&item->node);
+                free(item);
+                continue;
+            }
+
+            memmove(list->rendered + offset, list->rendered + item->offset, item->span);
+            item->offset = offset;
+            offset += item->span;
+        }
+        list->rendered_len = offset;
+    }
 
+    // hide the matching arguments of the base
+    if (list->base) {
+        cmdline_index_prefix_range(list->base, prefix, &lo, &hi);
+        count += hi - lo - shadowed;
+        for (i = lo; i < hi; i++) {
+            item = list->base->index[i];
+            cmdline_item_insert(list, item->name, item->name_len, NULL, 0, true, item);
+        }
+    }
+
+    return count;
+}
+
+size_t cmdline_length(cmdline_t* list)
+{
+    size_t len = list->rendered_len;
+
+    if (list->base)
+        len += list->base->rendered_len - list->base_hidden_len;
+
+    // the space behind the last argument becomes the 0 terminator
     return len;
 }
 
-size_t cmdline_generate(struct list_node* list, char* buf, size_t bufsize)
+// copies the base arguments which aren't hidden by the overlay
+static size_t cmdline_generate_base(cmdline_t* list, char* buf, size_t bufsize)
 {
+    cmdline_t* base = list->base;
+    cmdline_item_t *item;
+    size_t run_start = 0;
+    size_t run_len = 0;
     size_t len = 0;
 
-    if (bufsize>0)
-        buf[0] = 0;
+    if (!list->base_hidden_len) {
+        len = MIN(base->rendered_len, bufsize);
+        memcpy(buf, base->rendered, len);
+        return len;
+    }
 
-    cmdline_item_t *item;
-    list_for_every_entry(list, item, cmdline_item_t, node) {
-        if (len!=0) buf[len++] = ' ';
-        len+=strlcpy(buf+len, item->name, bufsize-len);
+    // copy runs of visible arguments with one memcpy each
+    list_for_every_entry(&base->items, item, cmdline_item_t, node) {
+        if (!cmdline_get_internal_n(list, item->name, item->name_len)) {
+            if (run_start + run_len != item->offset) {
+                run_start = item->offset;
+                run_len = 0;
+            }
+            run_len += item->span;
+            continue;
+        }
 
-        if (item->value) {
-            buf[len++] = '=';
-            len+=strlcpy(buf+len, item->value, bufsize-len);
+        if (run_len) {
+            run_len = MIN(run_len, bufsize - len);
+            memcpy(buf + len, base->rendered + run_start, run_len);
+            len += run_len;
+            run_len = 0;
         }
     }
 
+    if (run_len) {
+        run_len = MIN(run_len, bufsize - len);
+        memcpy(buf + len, base->rendered + run_start, run_len);
+        len += run_len;
+    }
+
     return len;
 }
 
-static int str2nameval(const char* str, char** name, char** value)
+size_t cmdline_generate(cmdline_t* list, char* buf, size_t bufsize)
 {
-    char *c;
-    int index;
-    char* ret_name;
-    char* ret_value;
+    size_t total = cmdline_length(list);
+    size_t len = total?total - 1:0;
+    size_t copy = 0;
 
-    // get index of delimiter
-    c = strchr(str, '=');
-    if (c==NULL) {
-        *name = strdup(str);
-        *value = NULL;
-        return -1;
-    }
-    index = (int)(c - str);
+    if (bufsize==0)
+        return len;
 
-    // get name
-    ret_name = malloc(index+1);
-    memcpy(ret_name, str, index);
-    ret_name[index] = 0;
+    if (list->base)
+        copy = cmdline_generate_base(list, buf, bufsize - 1);
 
-    // get value
-    ret_value = strdup(str+index+1);
+    // rendered is NULL as long as nothing has been added
+    size_t own = MIN(list->rendered_len, bufsize - 1 - copy);
+    if (own) {
+        memcpy(buf + copy, list->rendered, own);
+        copy += own;
+    }
 
-    *name = ret_name;
-    *value = ret_value;
+    // replace the space behind the last argument
+    copy = MIN(len, copy);
+    buf[copy] = 0;
 
-    return 0;
+    return len;
 }
 
-void cmdline_addall(struct list_node* list, const char* _cmdline, bool overwrite)
+bool cmdline_next_token(const char** pos, const char* end, cmdline_token_t* token)
 {
-    const char* sep = " ";
+    const char* p = *pos;
+    const char* start;
+    const char* equals = NULL;
+    bool in_quote = false;
+    bool quoted = false;
+
+    // skip leading spaces
+    while (p<end && isspace((unsigned char)*p))
+        p++;
+    if (p>=end || *p==0) {
+        *pos = p;
+        return false;
+    }
 
-    char* cmdline = strdup(_cmdline);
-    if (!cmdline) return;
+    // the whole argument may be quoted
+    if (*p=='"') {
+        p++;
+        in_quote = true;
+        quoted = true;
+    }
+    start = p;
+
+    // spaces within quotes don't end the argument
+    for (; p<end && *p; p++) {
+        if (isspace((unsigned char)*p) && !in_quote)
+            break;
+        if (!equals && *p=='=')
+            equals = p;
+        if (*p=='"')
+            in_quote = !in_quote;
+    }
+    *pos = p;
 
-    char *pch = strtok(cmdline, sep);
-    while (pch != NULL) {
-        // parse
-        char* name = NULL;
-        char* value = NULL;
-        str2nameval(pch, &name, &value);
+    if (quoted && p>start && p[-1]=='"')
+        p--;
 
-        // add
-        cmdline_add(list, name, value, overwrite);
+    if (!equals || equals>=p) {
+        token->name = start;
+        token->name_len = (size_t)(p - start);
+        token->value = NULL;
+        token->value_len = 0;
+        return true;
+    }
 
-        // free
-        free(name);
-        free(value);
+    token->name = start;
+    token->name_len = (size_t)(equals - start);
+    token->value = equals + 1;
 
-        // next
-        pch = strtok(NULL, sep);
+    // don't include quotes in the value
+    if (token->value<p && *token->value=='"') {
+        token->value++;
+        if (!quoted && p>token->value && p[-1]=='"')
+            p--;
     }
+    token->value_len = (size_t)(p - token->value);
 
-    free(cmdline);
+    return true;
+}
+
+void cmdline_add_token(cmdline_t* list, const cmdline_token_t* token, bool overwrite)
+{
+    cmdline_add_internal(list, token->name, token->name_len, token->value, token->value_len, overwrite);
 }
 
-void cmdline_addall_list(struct list_node* list_dst, struct list_node* list_src, bool overwrite)
+void cmdline_addall(cmdline_t* list, const char* cmdline, bool overwrite)
+{
+    cmdline_token_t token;
+
+    if (!cmdline) return;
+
+    const char* pos = cmdline;
+    const char* end = cmdline + strlen(cmdline);
+    while (cmdline_next_token(&pos, end, &token)) {
+        cmdline_add_token(list, &token, overwrite);
+    }
+}
+
+void cmdline_addall_list(cmdline_t* list_dst, cmdline_t* list_src, bool overwrite)
 {
     cmdline_item_t *item;
-    list_for_every_entry(list_src, item, cmdline_item_t, node) {
-        cmdline_add(list_dst, item->name, item->value, overwrite);
+
+    if (list_src->base) {
+        list_for_every_entry(&list_src->base->items, item, cmdline_item_t, node) {
+            if (cmdline_get_internal_n(list_src, item->name, item->name_len))
+                continue;
+            cmdline_add_internal(list_dst, item->name, item->name_len, item->value, item->value_len, overwrite);
+        }
+    }
+
+    list_for_every_entry(&list_src->items, item, cmdline_item_t, node) {
+        cmdline_add_internal(list_dst, item->name, item->name_len, item->value, item->value_len, overwrite);
     }
 }
 
-void cmdline_init(struct list_node* list)
+void cmdline_init(cmdline_t* list)
 {
-    list_initialize(list);
+    list_initialize(&list->items);
+    list->rendered = NULL;
+    list->rendered_len = 0;
+    list->rendered_size = 0;
+    list->index = NULL;
+    list->index_count = 0;
+    list->index_size = 0;
+    list->base = NULL;
+    list->base_hidden_len = 0;
+    list->overlays = 0;
 }
 
-void cmdline_free(struct list_node* list)
+void cmdline_init_overlay(cmdline_t* list, cmdline_t* base)
 {
-    while (!list_is_empty(list)) {
-        cmdline_item_t* item = list_remove_tail_type(list, cmdline_item_t, node);
+    // only one level of overlays is supported
+    ASSERT(!base->base);
 
-        free(item->name);
-        free(item->value);
-        free(item);
+    cmdline_init(list);
+    list->base = base;
+    base->overlays++;
+}
+
+void cmdline_free(cmdline_t* list)
+{
+    size_t i;
+
+    ASSERT(!list->overlays);
+
+    // masked items aren't part of the item list
+    for (i = 0; i < list->index_count; i++)
+        free(list->index[i]);
+    list_initialize(&list->items);
+
+    free(list->rendered);
+    list->rendered = NULL;
+    list->rendered_len = 0;
+    list->rendered_size = 0;
+    free(list->index);
+    list->index = NULL;
+    list->index_count = 0;
+    list->index_size = 0;
+
+    if (list->base) {
+        list->base->overlays--;
+        list->base = NULL;
     }
+    list->base_hidden_len = 0;
 }
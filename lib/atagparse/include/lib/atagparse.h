@@ -2,6 +2,7 @@
 #define ATAGPARSE_H
 
 #include <platform.h>
+#include <lib/cmdline.h>
 
 typedef enum {
     LKARGS_UEFI_BM_NORMAL = 0,
@@ -9,7 +10,8 @@ typedef enum {
 } lkargs_uefi_bootmode;
 
 const char* lkargs_get_command_line(void);
-struct list_node* lkargs_get_command_line_list(void);
+// replaces lkargs_get_command_line_list(), which returned the bare item list
+cmdline_t* lkargs_get_cmdline(void);
 const char* lkargs_get_panel_name(const char* key);
 lkargs_uefi_bootmode lkargs_get_uefi_bootmode(void);
 void* lkargs_get_tags_backup(void);
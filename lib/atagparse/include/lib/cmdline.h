@@ -26,16 +26,72 @@
         cmdline_add("androidboot.baseband", (str)); \
         break;
 
-bool cmdline_has(struct list_node* list, const char* name);
-const char* cmdline_get(struct list_node* list, const char* name);
-void cmdline_add(struct list_node* list, const char* name, const char* value, bool overwrite);
-void cmdline_remove(struct list_node* list, const char* name);
-size_t cmdline_length(struct list_node* list);
-size_t cmdline_generate(struct list_node* list, char* buf, size_t bufsize);
-void cmdline_addall(struct list_node* list, const char* cmdline, bool overwrite);
-void cmdline_addall_list(struct list_node* list_dst, struct list_node* list_src, bool overwrite);
-void cmdline_init(struct list_node* list);
-void cmdline_free(struct list_node* list);
+struct cmdline_item;
+
+typedef struct cmdline {
+    struct list_node items;
+
+    // items sorted by name, for lookups and prefix queries
+    struct cmdline_item** index;
+    size_t index_count;
+    size_t index_size;
+
+    // rendered command line, kept up to date on every add and remove.
+    // every argument is followed by a space which becomes the 0 terminator.
+    char* rendered;
+    size_t rendered_len;
+    size_t rendered_size;
+
+    // overlays only store their changes, everything else is looked up in
+    // the base list, which must not be modified while overlays exist.
+    struct cmdline* base;
+    // rendered length of the base arguments which are replaced or removed
+    size_t base_hidden_len;
+    // number of overlays using this list as their base
+    unsigned overlays;
+} cmdline_t;
+
+// iterates over all arguments with a given prefix in the order of their names.
+// the list must not be modified while iterating.
+typedef struct {
+    cmdline_t* list;
+    size_t pos;
+    size_t end;
+    size_t base_pos;
+    size_t base_end;
+} cmdline_iter_t;
+
+// one argument of a command line, pointing into the parsed string
+typedef struct {
+    const char* name;
+    size_t name_len;
+    // NULL if the argument has no '='
+    const char* value;
+    size_t value_len;
+} cmdline_token_t;
+
+// returns the next argument between *pos and end and advances *pos.
+// quoted values may contain spaces, the quotes aren't part of the token.
+bool cmdline_next_token(const char** pos, const char* end, cmdline_token_t* token);
+void cmdline_add_token(cmdline_t* list, const cmdline_token_t* token, bool overwrite);
+
+bool cmdline_has(cmdline_t* list, const char* name);
+const char* cmdline_get(cmdline_t* list, const char* name);
+void cmdline_add(cmdline_t* list, const char* name, const char* value, bool overwrite);
+void cmdline_remove(cmdline_t* list, const char* name);
+size_t cmdline_length(cmdline_t* list);
+size_t cmdline_generate(cmdline_t* list, char* buf, size_t bufsize);
+void cmdline_addall(cmdline_t* list, const char* cmdline, bool overwrite);
+void cmdline_addall_list(cmdline_t* list_dst, cmdline_t* list_src, bool overwrite);
+void cmdline_find_prefix(cmdline_t* list, const char* prefix, cmdline_iter_t* iter);
+bool cmdline_iter_next(cmdline_iter_t* iter, const char** name, const char** value);
+// removes all arguments with the given prefix and returns how many were visible.
+// the victims are found in O(log n), but closing the gaps in the rendered
+// command line moves every argument behind the first one, so this is O(n).
+size_t cmdline_remove_prefix(cmdline_t* list, const char* prefix);
+void cmdline_init(cmdline_t* list);
+void cmdline_init_overlay(cmdline_t* list, cmdline_t* base);
+void cmdline_free(cmdline_t* list);
 
 
 #endif
@@ -94,6 +94,11 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
+#include <lib/base64.h>
+#include <lib/crc32.h>
+
+#include "base64_simd.h"
 
 #define abort() assert(0)
 #define Assert(Cond) if (!(Cond)) abort()
@@ -166,7 +171,7 @@ static const char Pad64 = '=';
    */
 
 int
-b64_ntop(u_char const *src, size_t srclength, char *target, size_t targsize) {
+b64_ntop_scalar(u_char const *src, size_t srclength, char *target, size_t targsize) {
   size_t datalength = 0;
   u_char input[3];
   u_char output[4];
@@ -233,7 +238,7 @@ b64_ntop(u_char const *src, size_t srclength, char *target, size_t targsize) {
  */
 
 int
-b64_pton(
+b64_pton_scalar(
   char const *src,
   u_char *target,
   size_t targsize
@@ -354,3 +359,151 @@ b64_pton(
 
   return (tarindex);
 }
+
+/* The vectorized kernels handle the bulk of the data, the scalar
+   implementation above finishes the remainder.  Both produce exactly
+   the same output, see base64_simd.c.
+ */
+
+int
+b64_ntop(u_char const *src, size_t srclength, char *target, size_t targsize) {
+  size_t consumed, datalength;
+  int rc;
+
+  consumed = b64_simd_encode(src, srclength, target, targsize);
+  datalength = (consumed / 3) * 4;
+
+  rc = b64_ntop_scalar(src + consumed, srclength - consumed,
+                       target + datalength, targsize - datalength);
+  if (rc < 0)
+    return (-1);
+
+  return ((int)datalength + rc);
+}
+
+int
+b64_pton(
+  char const *src,
+  u_char *target,
+  size_t targsize
+  )
+{
+  size_t consumed, tarindex;
+  int rc;
+
+  /* Only the length is wanted, nothing to speed up. */
+  if (!target)
+    return b64_pton_scalar(src, target, targsize);
+
+  consumed = b64_simd_decode(src, strlen(src), target, targsize, &tarindex);
+
+  rc = b64_pton_scalar(src + consumed, target + tarindex, targsize - tarindex);
+  if (rc < 0)
+    return (-1);
+
+  return ((int)tarindex + rc);
+}
+
+/* The crc is calculated on blocks small enough to still be in the
+   cache when they get encoded, so the source is read from memory once.
+ */
+#define B64_CRC_BLOCK (3 * 256)
+
+static int
+b64_ntop_crc(b64_stream_t *ctx, u_char const *src, size_t srclength,
+             char *target, size_t targsize) {
+  size_t datalength = 0;
+  size_t n;
+  int rc;
+
+  if (!ctx->with_crc)
+    return b64_ntop(src, srclength, target, targsize);
+
+  do {
+    n = srclength < B64_CRC_BLOCK ? srclength : B64_CRC_BLOCK;
+
+    ctx->crc = crc32_update(ctx->crc, src, n);
+    rc = b64_ntop(src, n, target + datalength, targsize - datalength);
+    if (rc < 0)
+      return (-1);
+
+    datalength += rc;
+    src += n;
+    srclength -= n;
+  } while (srclength);
+
+  return ((int)datalength);
+}
+
+/* Streaming encoder.  Whole quanta are encoded right away, the 0-2
+   bytes which don't fill one are carried over to the next call, so the
+   concatenated output equals b64_ntop() of the concatenated input.
+ */
+
+void
+b64_stream_init(b64_stream_t *ctx) {
+  ctx->carry_len = 0;
+  ctx->with_crc = 0;
+  ctx->crc = 0;
+}
+
+void
+b64_stream_init_crc32(b64_stream_t *ctx) {
+  b64_stream_init(ctx);
+  ctx->with_crc = 1;
+}
+
+uint32_t
+b64_stream_crc32(b64_stream_t const *ctx) {
+  return (ctx->crc);
+}
+
+int
+b64_stream_update(b64_stream_t *ctx, u_char const *src, size_t srclength,
+                  char *target, size_t targsize) {
+  size_t datalength = 0;
+  size_t whole;
+  int rc;
+
+  /* Make sure everything fits before touching the context. */
+  if (((ctx->carry_len + srclength) / 3) * 4 >= targsize)
+    return (-1);
+
+  /* Complete the carried quantum first. */
+  if (ctx->carry_len) {
+    while (ctx->carry_len < 3 && srclength) {
+      ctx->carry[ctx->carry_len++] = *src++;
+      srclength--;
+    }
+    if (ctx->carry_len < 3) {
+      target[0] = '\0';
+      return (0);
+    }
+
+    rc = b64_ntop_crc(ctx, ctx->carry, 3, target, targsize);
+    if (rc < 0)
+      return (-1);
+    datalength = rc;
+    ctx->carry_len = 0;
+  }
+
+  whole = srclength - (srclength % 3);
+  rc = b64_ntop_crc(ctx, src, whole, target + datalength, targsize - datalength);
+  if (rc < 0)
+    return (-1);
+  datalength += rc;
+
+  /* The carried bytes are accounted when they are encoded. */
+  memcpy(ctx->carry, src + whole, srclength - whole);
+  ctx->carry_len = srclength - whole;
+
+  return ((int)datalength);
+}
+
+int
+b64_stream_final(b64_stream_t *ctx, char *target, size_t targsize) {
+  int rc = b64_ntop_crc(ctx, ctx->carry, ctx->carry_len, target, targsize);
+
+  ctx->carry_len = 0;
+  return (rc);
+}
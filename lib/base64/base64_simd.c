@@ -0,0 +1,307 @@
+#include <sys/types.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "base64_simd.h"
+
+/*
+ * All kernels map between 6-bit values and the alphabet arithmetically
+ * instead of using lookup tables:
+ *
+ *   0..25  'A'..'Z'  value + 65
+ *  26..51  'a'..'z'  value + 71
+ *  52..61  '0'..'9'  value - 4
+ *      62  '+'       value - 19
+ *      63  '/'       value - 16
+ */
+
+#if defined(__ARM_NEON) || defined(__ARM_NEON__)
+#include <arm_neon.h>
+
+static inline uint8x16_t b64_neon_enc_ascii(uint8x16_t v)
+{
+    uint8x16_t off = vdupq_n_u8(65);
+
+    off = vaddq_u8(off, vandq_u8(vcgeq_u8(v, vdupq_n_u8(26)), vdupq_n_u8(6)));
+    off = vsubq_u8(off, vandq_u8(vcgeq_u8(v, vdupq_n_u8(52)), vdupq_n_u8(75)));
+    off = vsubq_u8(off, vandq_u8(vcgeq_u8(v, vdupq_n_u8(62)), vdupq_n_u8(15)));
+    off = vaddq_u8(off, vandq_u8(vceqq_u8(v, vdupq_n_u8(63)), vdupq_n_u8(3)));
+
+    return vaddq_u8(v, off);
+}
+
+// returns the 6-bit values and sets all bits of *valid for alphabet characters
+static inline uint8x16_t b64_neon_dec_ascii(uint8x16_t c, uint8x16_t *valid)
+{
+    uint8x16_t upper = vcltq_u8(vsubq_u8(c, vdupq_n_u8('A')), vdupq_n_u8(26));
+    uint8x16_t lower = vcltq_u8(vsubq_u8(c, vdupq_n_u8('a')), vdupq_n_u8(26));
+    uint8x16_t digit = vcltq_u8(vsubq_u8(c, vdupq_n_u8('0')), vdupq_n_u8(10));
+    uint8x16_t plus  = vceqq_u8(c, vdupq_n_u8('+'));
+    uint8x16_t slash = vceqq_u8(c, vdupq_n_u8('/'));
+
+    uint8x16_t off = vandq_u8(upper, vdupq_n_u8((uint8_t)-65));
+    off = vorrq_u8(off, vandq_u8(lower, vdupq_n_u8((uint8_t)-71)));
+    off = vorrq_u8(off, vandq_u8(digit, vdupq_n_u8(4)));
+    off = vorrq_u8(off, vandq_u8(plus,  vdupq_n_u8(62 - '+')));
+    off = vorrq_u8(off, vandq_u8(slash, vdupq_n_u8(63 - '/')));
+
+    *valid = vorrq_u8(vorrq_u8(vorrq_u8(upper, lower), vorrq_u8(digit, plus)), slash);
+
+    return vaddq_u8(c, off);
+}
+
+static inline int b64_neon_all_set(uint8x16_t v)
+{
+#if defined(__aarch64__)
+    return vminvq_u8(v) == 0xff;
+#else
+    uint8x8_t m = vand_u8(vget_low_u8(v), vget_high_u8(v));
+    m = vpmin_u8(m, m);
+    m = vpmin_u8(m, m);
+    m = vpmin_u8(m, m);
+    return vget_lane_u8(m, 0) == 0xff;
+#endif
+}
+
+size_t b64_simd_encode(u_char const *src, size_t srclength, char *target, size_t targsize)
+{
+    size_t pos = 0;
+    size_t datalength = 0;
+    const uint8x16_t mask = vdupq_n_u8(0x3f);
+
+    // 48 bytes in, 64 characters out
+    while (srclength - pos >= 48 && targsize - datalength >= 64) {
+        uint8x16x3_t in = vld3q_u8(src + pos);
+        uint8x16x4_t out;
+
+        out.val[0] = vshrq_n_u8(in.val[0], 2);
+        out.val[1] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[1], 4), vshlq_n_u8(in.val[0], 4)), mask);
+        out.val[2] = vandq_u8(vorrq_u8(vshrq_n_u8(in.val[2], 6), vshlq_n_u8(in.val[1], 2)), mask);
+        out.val[3] = vandq_u8(in.val[2], mask);
+
+        out.val[0] = b64_neon_enc_ascii(out.val[0]);
+        out.val[1] = b64_neon_enc_ascii(out.val[1]);
+        out.val[2] = b64_neon_enc_ascii(out.val[2]);
+        out.val[3] = b64_neon_enc_ascii(out.val[3]);
+
+        vst4q_u8((uint8_t *)target + datalength, out);
+
+        pos += 48;
+        datalength += 64;
+    }
+
+    return pos;
+}
+
+size_t b64_simd_decode(char const *src, size_t srclength, u_char *target, size_t targsize, size_t *written)
+{
+    size_t pos = 0;
+    size_t tarindex = 0;
+
+    // 64 characters in, 48 bytes out
+    while (srclength - pos >= 64 && targsize - tarindex >= 48) {
+        uint8x16x4_t in = vld4q_u8((const uint8_t *)src + pos);
+        uint8x16x3_t out;
+        uint8x16_t v0, v1, v2, v3;
+        uint8x16_t ok0, ok1, ok2, ok3;
+
+        v0 = b64_neon_dec_ascii(in.val[0], &ok0);
+        v1 = b64_neon_dec_ascii(in.val[1], &ok1);
+        v2 = b64_neon_dec_ascii(in.val[2], &ok2);
+        v3 = b64_neon_dec_ascii(in.val[3], &ok3);
+
+        // let the scalar code deal with padding, whitespace and errors
+        if (!b64_neon_all_set(vandq_u8(vandq_u8(ok0, ok1), vandq_u8(ok2, ok3))))
+            break;
+
+        out.val[0] = vorrq_u8(vshlq_n_u8(v0, 2), vshrq_n_u8(v1, 4));
+        out.val[1] = vorrq_u8(vshlq_n_u8(v1, 4), vshrq_n_u8(v2, 2));
+        out.val[2] = vorrq_u8(vshlq_n_u8(v2, 6), v3);
+
+        vst3q_u8(target + tarindex, out);
+
+        pos += 64;
+        tarindex += 48;
+    }
+
+    *written = tarindex;
+    return pos;
+}
+
+#elif defined(__SSSE3__)
+#include <immintrin.h>
+
+// splits 12 bytes in each 128-bit lane into 16 6-bit values
+#define B64_X86_ENC_SHUFFLE 10, 11, 9, 10, 7, 8, 6, 7, 4, 5, 3, 4, 1, 2, 0, 1
+// picks the 12 decoded bytes of each 128-bit lane
+#define B64_X86_DEC_SHUFFLE -1, -1, -1, -1, 12, 13, 14, 8, 9, 10, 4, 5, 6, 0, 1, 2
+
+static inline __m128i b64_sse_enc_split(__m128i in)
+{
+    __m128i t0, t1, t2, t3;
+
+    in = _mm_shuffle_epi8(in, _mm_set_epi8(B64_X86_ENC_SHUFFLE));
+    t0 = _mm_and_si128(in, _mm_set1_epi32(0x0fc0fc00));
+    t1 = _mm_mulhi_epu16(t0, _mm_set1_epi32(0x04000040));
+    t2 = _mm_and_si128(in, _mm_set1_epi32(0x003f03f0));
+    t3 = _mm_mullo_epi16(t2, _mm_set1_epi32(0x01000010));
+
+    return _mm_or_si128(t1, t3);
+}
+
+static inline __m128i b64_sse_enc_ascii(__m128i v)
+{
+    __m128i off = _mm_set1_epi8(65);
+
+    off = _mm_add_epi8(off, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(25)), _mm_set1_epi8(6)));
+    off = _mm_sub_epi8(off, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(51)), _mm_set1_epi8(75)));
+    off = _mm_sub_epi8(off, _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(61)), _mm_set1_epi8(15)));
+    off = _mm_add_epi8(off, _mm_and_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(63)), _mm_set1_epi8(3)));
+
+    return _mm_add_epi8(v, off);
+}
+
+static inline __m128i b64_sse_range(__m128i c, char lo, char hi)
+{
+    return _mm_and_si128(_mm_cmpgt_epi8(c, _mm_set1_epi8(lo - 1)), _mm_cmplt_epi8(c, _mm_set1_epi8(hi + 1)));
+}
+
+static inline __m128i b64_sse_dec_ascii(__m128i c, __m128i *valid)
+{
+    __m128i upper = b64_sse_range(c, 'A', 'Z');
+    __m128i lower = b64_sse_range(c, 'a', 'z');
+    __m128i digit = b64_sse_range(c, '0', '9');
+    __m128i plus  = _mm_cmpeq_epi8(c, _mm_set1_epi8('+'));
+    __m128i slash = _mm_cmpeq_epi8(c, _mm_set1_epi8('/'));
+
+    __m128i off = _mm_and_si128(upper, _mm_set1_epi8(-65));
+    off = _mm_or_si128(off, _mm_and_si128(lower, _mm_set1_epi8(-71)));
+    off = _mm_or_si128(off, _mm_and_si128(digit, _mm_set1_epi8(4)));
+    off = _mm_or_si128(off, _mm_and_si128(plus,  _mm_set1_epi8(62 - '+')));
+    off = _mm_or_si128(off, _mm_and_si128(slash, _mm_set1_epi8(63 - '/')));
+
+    *valid = _mm_or_si128(_mm_or_si128(_mm_or_si128(upper, lower), _mm_or_si128(digit, plus)), slash);
+
+    return _mm_add_epi8(c, off);
+}
+
+static inline __m128i b64_sse_dec_pack(__m128i v)
+{
+    v = _mm_maddubs_epi16(v, _mm_set1_epi32(0x01400140));
+    v = _mm_madd_epi16(v, _mm_set1_epi32(0x00011000));
+
+    return _mm_shuffle_epi8(v, _mm_set_epi8(B64_X86_DEC_SHUFFLE));
+}
+
+static inline void b64_sse_store12(u_char *target, __m128i v)
+{
+    uint32_t hi = (uint32_t)_mm_cvtsi128_si32(_mm_srli_si128(v, 8));
+
+    _mm_storel_epi64((__m128i *)target, v);
+    memcpy(target + 8, &hi, sizeof(hi));
+}
+
+size_t b64_simd_encode(u_char const *src, size_t srclength, char *target, size_t targsize)
+{
+    size_t pos = 0;
+    size_t datalength = 0;
+
+#if defined(__AVX2__)
+    // 24 bytes in, 32 characters out. the loads read 4 bytes ahead.
+    while (srclength - pos >= 28 && targsize - datalength >= 32) {
+        __m256i in = _mm256_inserti128_si256(
+                         _mm256_castsi128_si256(_mm_loadu_si128((const __m128i *)(src + pos))),
+                         _mm_loadu_si128((const __m128i *)(src + pos + 12)), 1);
+        __m256i t0, t1, t2, t3, v, off;
+
+        in = _mm256_shuffle_epi8(in, _mm256_set_epi8(B64_X86_ENC_SHUFFLE, B64_X86_ENC_SHUFFLE));
+        t0 = _mm256_and_si256(in, _mm256_set1_epi32(0x0fc0fc00));
+        t1 = _mm256_mulhi_epu16(t0, _mm256_set1_epi32(0x04000040));
+        t2 = _mm256_and_si256(in, _mm256_set1_epi32(0x003f03f0));
+        t3 = _mm256_mullo_epi16(t2, _mm256_set1_epi32(0x01000010));
+        v = _mm256_or_si256(t1, t3);
+
+        off = _mm256_set1_epi8(65);
+        off = _mm256_add_epi8(off, _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(25)), _mm256_set1_epi8(6)));
+        off = _mm256_sub_epi8(off, _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(51)), _mm256_set1_epi8(75)));
+        off = _mm256_sub_epi8(off, _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(61)), _mm256_set1_epi8(15)));
+        off = _mm256_add_epi8(off, _mm256_and_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(63)), _mm256_set1_epi8(3)));
+
+        _mm256_storeu_si256((__m256i *)(target + datalength), _mm256_add_epi8(v, off));
+
+        pos += 24;
+        datalength += 32;
+    }
+#endif
+
+    // 12 bytes in, 16 characters out. the loads read 4 bytes ahead.
+    while (srclength - pos >= 16 && targsize - datalength >= 16) {
+        __m128i v = b64_sse_enc_split(_mm_loadu_si128((const __m128i *)(src + pos)));
+
+        _mm_storeu_si128((__m128i *)(target + datalength), b64_sse_enc_ascii(v));
+
+        pos += 12;
+        datalength += 16;
+    }
+
+    return pos;
+}
+
+size_t b64_simd_decode(char const *src, size_t srclength, u_char *target, size_t targsize, size_t *written)
+{
+    size_t pos = 0;
+    size_t tarindex = 0;
+
+#if defined(__AVX2__)
+    // 32 characters in, 24 bytes out
+    while (srclength - pos >= 32 && targsize - tarindex >= 24) {
+        __m256i c = _mm256_loadu_si256((const __m256i *)(src + pos));
+        __m128i lo, hi, ok_lo, ok_hi;
+
+        lo = b64_sse_dec_ascii(_mm256_castsi256_si128(c), &ok_lo);
+        hi = b64_sse_dec_ascii(_mm256_extracti128_si256(c, 1), &ok_hi);
+
+        // let the scalar code deal with padding, whitespace and errors
+        if (_mm_movemask_epi8(_mm_and_si128(ok_lo, ok_hi)) != 0xffff)
+            break;
+
+        b64_sse_store12(target + tarindex, b64_sse_dec_pack(lo));
+        b64_sse_store12(target + tarindex + 12, b64_sse_dec_pack(hi));
+
+        pos += 32;
+        tarindex += 24;
+    }
+#endif
+
+    // 16 characters in, 12 bytes out
+    while (srclength - pos >= 16 && targsize - tarindex >= 12) {
+        __m128i ok;
+        __m128i v = b64_sse_dec_ascii(_mm_loadu_si128((const __m128i *)(src + pos)), &ok);
+
+        if (_mm_movemask_epi8(ok) != 0xffff)
+            break;
+
+        b64_sse_store12(target + tarindex, b64_sse_dec_pack(v));
+
+        pos += 16;
+        tarindex += 12;
+    }
+
+    *written = tarindex;
+    return pos;
+}
+
+#else
+
+size_t b64_simd_encode(u_char const *src, size_t srclength, char *target, size_t targsize)
+{
+    return 0;
+}
+
+size_t b64_simd_decode(char const *src, size_t srclength, u_char *target, size_t targsize, size_t *written)
+{
+    *written = 0;
+    return 0;
+}
+
+#endif
@@ -0,0 +1,21 @@
+#ifndef BASE64_SIMD_H
+#define BASE64_SIMD_H
+
+#include <sys/types.h>
+
+/*
+ * Vectorized kernels for the bulk of the data, the callers handle the
+ * remainder (and everything involving padding or whitespace) with the
+ * scalar code, so the output is identical.
+ */
+
+// encodes whole blocks and returns the number of consumed source bytes,
+// which is always a multiple of 3. target must hold 4/3 of that.
+size_t b64_simd_encode(u_char const *src, size_t srclength, char *target, size_t targsize);
+
+// decodes whole blocks as long as they consist of alphabet characters only.
+// returns the number of consumed characters, which is always a multiple
+// of 4, and stores the number of written bytes in *written.
+size_t b64_simd_decode(char const *src, size_t srclength, u_char *target, size_t targsize, size_t *written);
+
+#endif // BASE64_SIMD_H
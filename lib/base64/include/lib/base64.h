@@ -1,6 +1,8 @@
 #ifndef BASE64_H
 #define BASE64_H
 
+#include <stdint.h>
+
 #define BASE64_ENCODED_SIZE(n) (ROUNDUP(4*((n)/3)+1, 4)+1)
 
 int
@@ -13,4 +15,47 @@ b64_pton(
   size_t targsize
   );
 
+// the plain ISC implementation, without the vectorized kernels
+int
+b64_ntop_scalar(unsigned char const *src, size_t srclength, char *target, size_t targsize);
+
+int
+b64_pton_scalar(
+  char const *src,
+  unsigned char *target,
+  size_t targsize
+  );
+
+// streaming encoder, the output of all calls together equals b64_ntop()
+// of the whole input. like b64_ntop, every call terminates its output.
+typedef struct {
+    unsigned char carry[3];
+    size_t carry_len;
+
+    // optional CRC32 of the encoded data, see lib/crc32
+    int with_crc;
+    uint32_t crc;
+} b64_stream_t;
+
+// upper bound of the characters produced by one update, without the terminator
+#define BASE64_STREAM_ENCODED_SIZE(n) (4*(((n)+2)/3))
+
+void
+b64_stream_init(b64_stream_t *ctx);
+
+// additionally calculates the CRC32 of the input while encoding it
+void
+b64_stream_init_crc32(b64_stream_t *ctx);
+
+// only complete after b64_stream_final
+uint32_t
+b64_stream_crc32(b64_stream_t const *ctx);
+
+int
+b64_stream_update(b64_stream_t *ctx, unsigned char const *src, size_t srclength,
+                  char *target, size_t targsize);
+
+int
+b64_stream_final(b64_stream_t *ctx, char *target, size_t targsize);
+
 #endif // BASE64_H
@@ -2,5 +2,9 @@ LOCAL_DIR := $(GET_LOCAL_DIR)
 
 INCLUDES += -I$(LOCAL_DIR)/include
 
+MODULES += \
+	lib/crc32
+
 OBJS += \
-	$(LOCAL_DIR)/base64.o
+	$(LOCAL_DIR)/base64.o \
+	$(LOCAL_DIR)/base64_simd.o
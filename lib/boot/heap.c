@@ -51,6 +51,9 @@ struct heap {
 	void *base;
 	size_t len;
 	struct list_node free_list;
+
+	// end of the memory which has been touched so far
+	void *high;
 };
 
 // heap static vars
@@ -290,6 +293,11 @@ void *libboot_platform_heap_alloc(size_t size, unsigned int alignment)
 			DEBUG_ASSERT(chunk->len >= size);
 			size = chunk->len;
 
+			// including the header of the free chunk which follows
+			void *end = (uint8_t *)chunk + size + sizeof(struct free_heap_chunk);
+			if (end > theheap.high)
+				theheap.high = end;
+
 #if DEBUG_HEAP
 			memset(ptr, ALLOC_FILL, size);
 #endif
@@ -402,6 +410,7 @@ void libboot_platform_heap_init(void* base, size_t len)
 
 	// create an initial free chunk
 	heap_insert_free_chunk(heap_create_free_chunk(theheap.base, theheap.len));
+	theheap.high = (uint8_t *)theheap.base + sizeof(struct free_heap_chunk);
 
 	// dump heap info
 //	heap_dump();
@@ -409,3 +418,10 @@ void libboot_platform_heap_init(void* base, size_t len)
 //	dprintf(INFO, "running heap tests\n");
 //	heap_test();
 }
+
+size_t libboot_platform_heap_used(void)
+{
+	size_t used = (uint8_t *)theheap.high - (uint8_t *)theheap.base;
+
+	return (used < theheap.len) ? used : theheap.len;
+}
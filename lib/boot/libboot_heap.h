@@ -31,6 +31,9 @@ void libboot_platform_heap_free(void *);
 
 void libboot_platform_heap_init(void* base, size_t len);
 
+// number of bytes from the start of the heap which have been used so far
+size_t libboot_platform_heap_used(void);
+
 
 
 #endif
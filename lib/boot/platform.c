@@ -74,6 +74,10 @@ boot_uintn_t libboot_platform_machtype(void) {
 }
 
 void libboot_platform_memmove(void* dst, const void* src, boot_uintn_t num) {
+    // images which get booted in place
+    if(dst==src)
+        return;
+
     memmove(dst, src, num);
 }
 
@@ -145,13 +149,59 @@ void libboot_platform_free(void *ptr) {
     libboot_platform_heap_free(ptr);
 }
 
+// the ranges which got handed out for the kernel, ramdisk and tags, so
+// the caches can be cleaned for just these before booting
+#define LIBBOOT_MAX_BOOTALLOCS 16
+
+static struct {
+    boot_uintn_t addr;
+    boot_uintn_t sz;
+} bootallocs[LIBBOOT_MAX_BOOTALLOCS];
+static unsigned bootalloc_count = 0;
+static int bootalloc_overflow = 0;
+
 void* libboot_platform_bootalloc(boot_uintn_t addr, boot_uintn_t sz) {
     if(check_aboot_addr_range_overlap(addr, sz)) {
         return NULL;
     }
 
+    if(bootalloc_count < LIBBOOT_MAX_BOOTALLOCS) {
+        bootallocs[bootalloc_count].addr = addr;
+        bootallocs[bootalloc_count].sz = sz;
+        bootalloc_count++;
+    }
+    else {
+        bootalloc_overflow = 1;
+    }
+
     return (void*)addr;
 }
 
 void libboot_platform_bootfree(boot_uintn_t addr, boot_uintn_t sz) {
+    unsigned i;
+
+    for(i=0; i<bootalloc_count; i++) {
+        if(bootallocs[i].addr==addr && bootallocs[i].sz==sz) {
+            bootallocs[i] = bootallocs[--bootalloc_count];
+            break;
+        }
+    }
+}
+
+void libboot_platform_bootalloc_reset(void) {
+    bootalloc_count = 0;
+    bootalloc_overflow = 0;
+}
+
+int libboot_platform_bootalloc_foreach(void *pdata, void (*cb)(void *pdata, boot_uintn_t addr, boot_uintn_t sz)) {
+    unsigned i;
+
+    // we lost track of some of them
+    if(bootalloc_overflow)
+        return -1;
+
+    for(i=0; i<bootalloc_count; i++)
+        cb(pdata, bootallocs[i].addr, bootallocs[i].sz);
+
+    return 0;
 }
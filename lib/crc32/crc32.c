@@ -0,0 +1,54 @@
+#include <string.h>
+#include <lib/crc32.h>
+
+// the crc is kept inverted while running
+#if defined(__ARM_FEATURE_CRC32)
+#include <arm_acle.h>
+
+static uint32_t crc32_raw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    uint32_t word;
+
+    while (len && ((uintptr_t)buf & 3)) {
+        crc = __crc32b(crc, *buf++);
+        len--;
+    }
+    while (len >= 4) {
+        memcpy(&word, buf, 4);
+        crc = __crc32w(crc, word);
+        buf += 4;
+        len -= 4;
+    }
+    while (len--)
+        crc = __crc32b(crc, *buf++);
+
+    return crc;
+}
+#else
+static uint32_t crc32_table[256];
+
+static uint32_t crc32_raw(uint32_t crc, const uint8_t *buf, size_t len)
+{
+    uint32_t c;
+    int i, j;
+
+    if (!crc32_table[1]) {
+        for (i = 0; i < 256; i++) {
+            c = (uint32_t)i;
+            for (j = 0; j < 8; j++)
+                c = (c & 1) ? (c >> 1) ^ 0xedb88320 : (c >> 1);
+            crc32_table[i] = c;
+        }
+    }
+
+    while (len--)
+        crc = crc32_table[(crc ^ *buf++) & 0xff] ^ (crc >> 8);
+
+    return crc;
+}
+#endif
+
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len)
+{
+    return crc32_raw(crc ^ 0xffffffff, buf, len) ^ 0xffffffff;
+}
@@ -0,0 +1,10 @@
+#ifndef CRC32_H
+#define CRC32_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+// CRC32 (IEEE 802.3) compatible with zlib's crc32(), start with 0
+uint32_t crc32_update(uint32_t crc, const void *buf, size_t len);
+
+#endif // CRC32_H
@@ -0,0 +1,55 @@
+#ifndef LZ4_H
+#define LZ4_H
+
+#include <sys/types.h>
+#include <stdint.h>
+
+/*
+ * Streaming LZ4 frame compressor.
+ * The output is a standard LZ4 frame with independent 64KB blocks and a
+ * content checksum, so it can be decompressed with the lz4 tool.
+ */
+
+#define LZ4_BLOCK_SIZE (64 * 1024)
+#define LZ4_HASH_LOG 12
+
+// magic, FLG, BD, HC
+#define LZ4_FRAME_HEADER_SIZE 7
+
+// upper bound of the bytes produced by one update of n bytes or by final
+#define LZ4_STREAM_BOUND(n) \
+    (LZ4_FRAME_HEADER_SIZE + ((n) / LZ4_BLOCK_SIZE + 1) * (4 + LZ4_BLOCK_SIZE) + 8)
+
+typedef struct {
+    uint64_t total_len;
+    uint32_t v[4];
+    uint8_t mem[16];
+    uint32_t memsize;
+} lz4_xxh32_t;
+
+typedef struct {
+    int started;
+
+    // content checksum
+    lz4_xxh32_t xxh;
+
+    // incomplete block from previous updates
+    size_t len;
+    uint8_t buf[LZ4_BLOCK_SIZE];
+
+    uint16_t table[1 << LZ4_HASH_LOG];
+} lz4_stream_t;
+
+void lz4_xxh32_init(lz4_xxh32_t *ctx, uint32_t seed);
+void lz4_xxh32_update(lz4_xxh32_t *ctx, const void *buf, size_t len);
+uint32_t lz4_xxh32_digest(const lz4_xxh32_t *ctx);
+
+void lz4_stream_init(lz4_stream_t *ctx);
+
+// returns the number of bytes written to target or -1 if it's too small
+int lz4_stream_update(lz4_stream_t *ctx, const void *src, size_t srclength, void *target, size_t targsize);
+
+// writes the remaining block, the end mark and the checksum
+int lz4_stream_final(lz4_stream_t *ctx, void *target, size_t targsize);
+
+#endif // LZ4_H
@@ -0,0 +1,401 @@
+#include <stdlib.h>
+#include <string.h>
+#include <lib/lz4.h>
+
+#define LZ4_MAGIC 0x184D2204
+// version 1, independent blocks, content checksum
+#define LZ4_FLG 0x64
+// 64KB blocks
+#define LZ4_BD 0x40
+#define LZ4_UNCOMPRESSED_FLAG 0x80000000
+
+// the last match has to start 12 bytes before the end of a block,
+// and the last 5 bytes are always literals
+#define LZ4_MFLIMIT 12
+#define LZ4_LASTLITERALS 5
+// after this many misses the step size grows, so incompressible data is skipped faster
+#define LZ4_SKIP_TRIGGER 6
+
+#define XXH_PRIME32_1 2654435761U
+#define XXH_PRIME32_2 2246822519U
+#define XXH_PRIME32_3 3266489917U
+#define XXH_PRIME32_4 668265263U
+#define XXH_PRIME32_5 374761393U
+
+static inline uint32_t lz4_read32(const void *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint64_t lz4_read64(const void *p)
+{
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline void lz4_write32(uint8_t *p, uint32_t v)
+{
+    p[0] = v;
+    p[1] = v >> 8;
+    p[2] = v >> 16;
+    p[3] = v >> 24;
+}
+
+static inline uint32_t lz4_rotl32(uint32_t x, int r)
+{
+    return (x << r) | (x >> (32 - r));
+}
+
+static inline uint32_t xxh32_round(uint32_t acc, uint32_t input)
+{
+    acc += input * XXH_PRIME32_2;
+    acc = lz4_rotl32(acc, 13);
+    return acc * XXH_PRIME32_1;
+}
+
+static void xxh32_stripe(uint32_t *v, const uint8_t *p)
+{
+    v[0] = xxh32_round(v[0], lz4_read32(p));
+    v[1] = xxh32_round(v[1], lz4_read32(p + 4));
+    v[2] = xxh32_round(v[2], lz4_read32(p + 8));
+    v[3] = xxh32_round(v[3], lz4_read32(p + 12));
+}
+
+void lz4_xxh32_init(lz4_xxh32_t *ctx, uint32_t seed)
+{
+    ctx->total_len = 0;
+    ctx->v[0] = seed + XXH_PRIME32_1 + XXH_PRIME32_2;
+    ctx->v[1] = seed + XXH_PRIME32_2;
+    ctx->v[2] = seed;
+    ctx->v[3] = seed - XXH_PRIME32_1;
+    ctx->memsize = 0;
+}
+
+void lz4_xxh32_update(lz4_xxh32_t *ctx, const void *buf, size_t len)
+{
+    const uint8_t *p = buf;
+    const uint8_t *end = p + len;
+
+    ctx->total_len += len;
+
+    if (ctx->memsize + len < sizeof(ctx->mem)) {
+        memcpy(ctx->mem + ctx->memsize, p, len);
+        ctx->memsize += len;
+        return;
+    }
+
+    if (ctx->memsize) {
+        size_t n = sizeof(ctx->mem) - ctx->memsize;
+
+        memcpy(ctx->mem + ctx->memsize, p, n);
+        xxh32_stripe(ctx->v, ctx->mem);
+
+        p += n;
+        ctx->memsize = 0;
+    }
+
+    while (end - p >= 16) {
+        xxh32_stripe(ctx->v, p);
+        p += 16;
+    }
+
+    memcpy(ctx->mem, p, end - p);
+    ctx->memsize = end - p;
+}
+
+uint32_t lz4_xxh32_digest(const lz4_xxh32_t *ctx)
+{
+    const uint8_t *p = ctx->mem;
+    const uint8_t *end = p + ctx->memsize;
+    uint32_t h;
+
+    if (ctx->total_len >= 16)
+        h = lz4_rotl32(ctx->v[0], 1) + lz4_rotl32(ctx->v[1], 7) + lz4_rotl32(ctx->v[2], 12) + lz4_rotl32(ctx->v[3], 18);
+    else
+        h = ctx->v[2] + XXH_PRIME32_5;
+
+    h += (uint32_t)ctx->total_len;
+
+    while (end - p >= 4) {
+        h += lz4_read32(p) * XXH_PRIME32_3;
+        h = lz4_rotl32(h, 17) * XXH_PRIME32_4;
+        p += 4;
+    }
+
+    while (p < end) {
+        h += (*p++) * XXH_PRIME32_5;
+        h = lz4_rotl32(h, 11) * XXH_PRIME32_1;
+    }
+
+    h ^= h >> 15;
+    h *= XXH_PRIME32_2;
+    h ^= h >> 13;
+    h *= XXH_PRIME32_3;
+    h ^= h >> 16;
+
+    return h;
+}
+
+static inline uint32_t lz4_hash(uint32_t seq)
+{
+    return (seq * 2654435761U) >> (32 - LZ4_HASH_LOG);
+}
+
+// number of equal bytes, the word compare assumes little endian
+static size_t lz4_count(const uint8_t *p, const uint8_t *ref, const uint8_t *limit)
+{
+    const uint8_t *start = p;
+
+    while (limit - p >= 8) {
+        uint64_t diff = lz4_read64(p) ^ lz4_read64(ref);
+        if (diff)
+            return p - start + (__builtin_ctzll(diff) >> 3);
+
+        p += 8;
+        ref += 8;
+    }
+
+    while (p < limit && *p == *ref) {
+        p++;
+        ref++;
+    }
+
+    return p - start;
+}
+
+static uint8_t *lz4_write_length(uint8_t *op, size_t len)
+{
+    while (len >= 255) {
+        *op++ = 255;
+        len -= 255;
+    }
+    *op++ = len;
+
+    return op;
+}
+
+// writes one sequence, a match length of 0 writes the final literals.
+// returns NULL if it doesn't fit.
+static uint8_t *lz4_emit(uint8_t *op, uint8_t *oend, const uint8_t *lit, size_t litlen, size_t offset, size_t mlen)
+{
+    size_t need = 1 + litlen + (litlen >= 15 ? (litlen - 15) / 255 + 1 : 0);
+    if (mlen)
+        need += 2 + (mlen - 4 >= 15 ? (mlen - 4 - 15) / 255 + 1 : 0);
+    if (need > (size_t)(oend - op))
+        return NULL;
+
+    uint8_t *token = op++;
+    *token = MIN(litlen, 15) << 4;
+    if (litlen >= 15)
+        op = lz4_write_length(op, litlen - 15);
+
+    memcpy(op, lit, litlen);
+    op += litlen;
+
+    if (mlen) {
+        *op++ = offset;
+        *op++ = offset >> 8;
+
+        *token |= MIN(mlen - 4, 15);
+        if (mlen - 4 >= 15)
+            op = lz4_write_length(op, mlen - 4 - 15);
+    }
+
+    return op;
+}
+
+static int lz4_is_zero(const uint8_t *p, size_t n)
+{
+    const uint8_t *end = p + n;
+
+    while (end - p >= 32) {
+        if (lz4_read64(p) | lz4_read64(p + 8) | lz4_read64(p + 16) | lz4_read64(p + 24))
+            return 0;
+        p += 32;
+    }
+
+    while (p < end) {
+        if (*p++)
+            return 0;
+    }
+
+    return 1;
+}
+
+// returns the compressed size or 0 if it doesn't fit into cap
+static size_t lz4_compress_block(lz4_stream_t *ctx, const uint8_t *src, size_t n, uint8_t *dst, size_t cap)
+{
+    const uint8_t *ip = src;
+    const uint8_t *anchor = src;
+    const uint8_t *iend = src + n;
+    uint8_t *op = dst;
+    uint8_t *oend = dst + cap;
+
+    if (n > LZ4_MFLIMIT) {
+        const uint8_t *mflimit = iend - LZ4_MFLIMIT;
+        const uint8_t *matchlimit = iend - LZ4_LASTLITERALS;
+
+        // RAM dumps contain lots of unused pages, skip the match finder
+        // for them and emit one literal followed by a single long match
+        if (lz4_is_zero(src, n)) {
+            op = lz4_emit(op, oend, src, 1, 1, n - 1 - LZ4_LASTLITERALS);
+            if (!op)
+                return 0;
+            anchor = matchlimit;
+            goto last_literals;
+        }
+
+        memset(ctx->table, 0, sizeof(ctx->table));
+
+        // the first byte can't be part of a match
+        ip++;
+
+        unsigned attempts = 1 << LZ4_SKIP_TRIGGER;
+        while (ip <= mflimit) {
+            uint32_t seq = lz4_read32(ip);
+            uint32_t h = lz4_hash(seq);
+            const uint8_t *ref = src + ctx->table[h];
+            ctx->table[h] = ip - src;
+
+            if (lz4_read32(ref) != seq || ref >= ip) {
+                ip += attempts++ >> LZ4_SKIP_TRIGGER;
+                continue;
+            }
+            attempts = 1 << LZ4_SKIP_TRIGGER;
+
+            while (ip > anchor && ref > src && ip[-1] == ref[-1]) {
+                ip--;
+                ref--;
+            }
+
+            size_t mlen = 4 + lz4_count(ip + 4, ref + 4, matchlimit);
+            op = lz4_emit(op, oend, anchor, ip - anchor, ip - ref, mlen);
+            if (!op)
+                return 0;
+
+            ip += mlen;
+            anchor = ip;
+
+            if (ip <= mflimit)
+                ctx->table[lz4_hash(lz4_read32(ip - 2))] = ip - 2 - src;
+        }
+    }
+
+last_literals:
+    op = lz4_emit(op, oend, anchor, iend - anchor, 0, 0);
+    if (!op)
+        return 0;
+
+    return op - dst;
+}
+
+static size_t lz4_write_header(uint8_t *op)
+{
+    lz4_xxh32_t xxh;
+
+    lz4_write32(op, LZ4_MAGIC);
+    op[4] = LZ4_FLG;
+    op[5] = LZ4_BD;
+
+    lz4_xxh32_init(&xxh, 0);
+    lz4_xxh32_update(&xxh, op + 4, 2);
+    op[6] = (lz4_xxh32_digest(&xxh) >> 8) & 0xff;
+
+    return LZ4_FRAME_HEADER_SIZE;
+}
+
+static size_t lz4_write_block(lz4_stream_t *ctx, const uint8_t *src, size_t n, uint8_t *op)
+{
+    // only use the compressed data if it's actually smaller
+    size_t csize = lz4_compress_block(ctx, src, n, op + 4, n - 1);
+    if (csize) {
+        lz4_write32(op, csize);
+    } else {
+        memcpy(op + 4, src, n);
+        lz4_write32(op, n | LZ4_UNCOMPRESSED_FLAG);
+        csize = n;
+    }
+
+    lz4_xxh32_update(&ctx->xxh, src, n);
+
+    return 4 + csize;
+}
+
+void lz4_stream_init(lz4_stream_t *ctx)
+{
+    ctx->started = 0;
+    ctx->len = 0;
+    lz4_xxh32_init(&ctx->xxh, 0);
+}
+
+int lz4_stream_update(lz4_stream_t *ctx, const void *src, size_t srclength, void *target, size_t targsize)
+{
+    const uint8_t *ip = src;
+    uint8_t *op = target;
+
+    size_t need = (ctx->started ? 0 : LZ4_FRAME_HEADER_SIZE) + ((ctx->len + srclength) / LZ4_BLOCK_SIZE) * (4 + LZ4_BLOCK_SIZE);
+    if (need > targsize)
+        return -1;
+
+    if (!ctx->started) {
+        op += lz4_write_header(op);
+        ctx->started = 1;
+    }
+
+    // complete the buffered block first
+    if (ctx->len) {
+        size_t n = MIN(srclength, LZ4_BLOCK_SIZE - ctx->len);
+
+        memcpy(ctx->buf + ctx->len, ip, n);
+        ctx->len += n;
+        ip += n;
+        srclength -= n;
+
+        if (ctx->len < LZ4_BLOCK_SIZE)
+            return op - (uint8_t *)target;
+
+        op += lz4_write_block(ctx, ctx->buf, LZ4_BLOCK_SIZE, op);
+        ctx->len = 0;
+    }
+
+    // whole blocks get compressed straight from the source
+    while (srclength >= LZ4_BLOCK_SIZE) {
+        op += lz4_write_block(ctx, ip, LZ4_BLOCK_SIZE, op);
+        ip += LZ4_BLOCK_SIZE;
+        srclength -= LZ4_BLOCK_SIZE;
+    }
+
+    memcpy(ctx->buf, ip, srclength);
+    ctx->len = srclength;
+
+    return op - (uint8_t *)target;
+}
+
+int lz4_stream_final(lz4_stream_t *ctx, void *target, size_t targsize)
+{
+    uint8_t *op = target;
+
+    size_t need = (ctx->started ? 0 : LZ4_FRAME_HEADER_SIZE) + (ctx->len ? 4 + ctx->len : 0) + 8;
+    if (need > targsize)
+        return -1;
+
+    if (!ctx->started) {
+        op += lz4_write_header(op);
+        ctx->started = 1;
+    }
+
+    if (ctx->len) {
+        op += lz4_write_block(ctx, ctx->buf, ctx->len, op);
+        ctx->len = 0;
+    }
+
+    // end mark and content checksum
+    lz4_write32(op, 0);
+    lz4_write32(op + 4, lz4_xxh32_digest(&ctx->xxh));
+    op += 8;
+
+    return op - (uint8_t *)target;
+}
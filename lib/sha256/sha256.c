@@ -0,0 +1,148 @@
+#include <string.h>
+#include <lib/sha256.h>
+
+static const uint32_t sha256_k[64] = {
+    0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+    0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+    0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+    0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+    0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+    0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+    0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+    0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static inline uint32_t sha256_rotr(uint32_t x, int r)
+{
+    return (x >> r) | (x << (32 - r));
+}
+
+static inline uint32_t sha256_read_be32(const uint8_t *p)
+{
+    return ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+}
+
+static inline void sha256_write_be32(uint8_t *p, uint32_t v)
+{
+    p[0] = v >> 24;
+    p[1] = v >> 16;
+    p[2] = v >> 8;
+    p[3] = v;
+}
+
+static void sha256_block(uint32_t *state, const uint8_t *p)
+{
+    uint32_t w[64];
+    uint32_t a, b, c, d, e, f, g, h;
+    int i;
+
+    for (i = 0; i < 16; i++)
+        w[i] = sha256_read_be32(p + i * 4);
+    for (i = 16; i < 64; i++) {
+        uint32_t s0 = sha256_rotr(w[i - 15], 7) ^ sha256_rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+        uint32_t s1 = sha256_rotr(w[i - 2], 17) ^ sha256_rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+        w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    a = state[0];
+    b = state[1];
+    c = state[2];
+    d = state[3];
+    e = state[4];
+    f = state[5];
+    g = state[6];
+    h = state[7];
+
+    for (i = 0; i < 64; i++) {
+        uint32_t s1 = sha256_rotr(e, 6) ^ sha256_rotr(e, 11) ^ sha256_rotr(e, 25);
+        uint32_t ch = (e & f) ^ (~e & g);
+        uint32_t t1 = h + s1 + ch + sha256_k[i] + w[i];
+        uint32_t s0 = sha256_rotr(a, 2) ^ sha256_rotr(a, 13) ^ sha256_rotr(a, 22);
+        uint32_t maj = (a & b) ^ (a & c) ^ (b & c);
+        uint32_t t2 = s0 + maj;
+
+        h = g;
+        g = f;
+        f = e;
+        e = d + t1;
+        d = c;
+        c = b;
+        b = a;
+        a = t1 + t2;
+    }
+
+    state[0] += a;
+    state[1] += b;
+    state[2] += c;
+    state[3] += d;
+    state[4] += e;
+    state[5] += f;
+    state[6] += g;
+    state[7] += h;
+}
+
+void sha256_init(sha256_ctx_t *ctx)
+{
+    ctx->state[0] = 0x6a09e667;
+    ctx->state[1] = 0xbb67ae85;
+    ctx->state[2] = 0x3c6ef372;
+    ctx->state[3] = 0xa54ff53a;
+    ctx->state[4] = 0x510e527f;
+    ctx->state[5] = 0x9b05688c;
+    ctx->state[6] = 0x1f83d9ab;
+    ctx->state[7] = 0x5be0cd19;
+    ctx->total_len = 0;
+    ctx->len = 0;
+}
+
+void sha256_update(sha256_ctx_t *ctx, const void *data, size_t len)
+{
+    const uint8_t *p = data;
+
+    ctx->total_len += len;
+
+    // complete the buffered block first
+    if (ctx->len) {
+        size_t n = SHA256_BLOCK_SIZE - ctx->len;
+        if (n > len)
+            n = len;
+
+        memcpy(ctx->buf + ctx->len, p, n);
+        ctx->len += n;
+        p += n;
+        len -= n;
+
+        if (ctx->len < SHA256_BLOCK_SIZE)
+            return;
+
+        sha256_block(ctx->state, ctx->buf);
+        ctx->len = 0;
+    }
+
+    for (; len >= SHA256_BLOCK_SIZE; p += SHA256_BLOCK_SIZE, len -= SHA256_BLOCK_SIZE)
+        sha256_block(ctx->state, p);
+
+    memcpy(ctx->buf, p, len);
+    ctx->len = len;
+}
+
+void sha256_final(sha256_ctx_t *ctx, uint8_t digest[SHA256_DIGEST_SIZE])
+{
+    uint64_t bits = ctx->total_len * 8;
+    int i;
+
+    // the padding starts with a single 1 bit and ends with the length
+    ctx->buf[ctx->len++] = 0x80;
+    if (ctx->len > SHA256_BLOCK_SIZE - 8) {
+        memset(ctx->buf + ctx->len, 0, SHA256_BLOCK_SIZE - ctx->len);
+        sha256_block(ctx->state, ctx->buf);
+        ctx->len = 0;
+    }
+    memset(ctx->buf + ctx->len, 0, SHA256_BLOCK_SIZE - 8 - ctx->len);
+    sha256_write_be32(ctx->buf + SHA256_BLOCK_SIZE - 8, bits >> 32);
+    sha256_write_be32(ctx->buf + SHA256_BLOCK_SIZE - 4, bits);
+    sha256_block(ctx->state, ctx->buf);
+
+    for (i = 0; i < 8; i++)
+        sha256_write_be32(digest + i * 4, ctx->state[i]);
+}
@@ -0,0 +1,173 @@
+#!/usr/bin/env python3
+#
+# Flashes only the parts of a raw image which differ from what's on the
+# device. The device hashes the partition with 'oem block-sums', the
+# changed ranges are sent with 'fastboot stage' and written by
+# 'oem delta-write'.
+
+import argparse
+import hashlib
+import os
+import re
+import struct
+import subprocess
+import sys
+import tempfile
+
+DELTA_MAGIC = 0x41544c44
+SPARSE_MAGIC = 0xed26ff3a
+DEFAULT_RANGE_SIZE = 1 << 20
+# only this many bytes of each range's sha256 are in the manifest
+DIGEST_SIZE = 8
+# the data of a payload starts at a multiple of this, which keeps it
+# cache-line and block aligned in the download buffer
+DATA_ALIGN = 4096
+HEADER = struct.Struct('<IIII')
+RANGE = struct.Struct('<QII')
+
+
+class DeltaError(Exception):
+    pass
+
+
+class Fastboot:
+    def __init__(self, path, serial):
+        self.cmd = [path] + (['-s', serial] if serial else [])
+
+    def run(self, *args):
+        p = subprocess.run(self.cmd + list(args), stdout=subprocess.PIPE, stderr=subprocess.STDOUT)
+        out = p.stdout.decode('utf-8', 'replace')
+        if p.returncode:
+            raise DeltaError('fastboot %s failed:\n%s' % (' '.join(args), out))
+        return out
+
+    def max_download_size(self):
+        m = re.search(r'max-download-size:\s*(0x[0-9a-fA-F]+|\d+)', self.run('getvar', 'max-download-size'))
+        return int(m.group(1), 0) if m else 64 << 20
+
+    def block_sums(self, partition, range_size, length):
+        out = self.run('oem', 'block-sums', partition, '%x' % range_size, '%x' % length)
+
+        sums = {}
+        for line in out.splitlines():
+            line = re.sub(r'^\(bootloader\)\s?', '', line.strip())
+            m = re.match(r'^ranges ([0-9a-f]+) ([0-9a-f]+)$', line)
+            if m and (int(m.group(1), 16), int(m.group(2), 16)) != (range_size, length):
+                raise DeltaError('unexpected manifest layout: %s' % line)
+            m = re.match(r'^([0-9a-f]+) ([0-9a-f]{%d})$' % (DIGEST_SIZE * 2), line)
+            if m:
+                sums[int(m.group(1), 16)] = m.group(2)
+
+        expected = (length + range_size - 1) // range_size
+        if len(sums) != expected:
+            raise DeltaError('got %d of %d checksums' % (len(sums), expected))
+        return sums
+
+
+def changed_ranges(image, sums, range_size):
+    # adjacent changed ranges are merged
+    ranges = []
+    for offset in range(0, len(image), range_size):
+        chunk = image[offset:offset + range_size]
+        if hashlib.sha256(chunk).hexdigest()[:DIGEST_SIZE * 2] == sums[offset]:
+            continue
+
+        if ranges and ranges[-1][0] + ranges[-1][1] == offset:
+            ranges[-1][1] += len(chunk)
+        else:
+            ranges.append([offset, len(chunk)])
+    return ranges
+
+
+def build_payloads(image, ranges, max_size):
+    # ranges are split so that every payload fits into the download buffer,
+    # the pieces stay block aligned because max_piece is
+    max_piece = (max_size - 2 * DATA_ALIGN) // DATA_ALIGN * DATA_ALIGN
+    if max_piece <= 0:
+        raise DeltaError('download buffer too small')
+
+    pieces = []
+    for offset, length in ranges:
+        for o in range(offset, offset + length, max_piece):
+            pieces.append((o, min(max_piece, offset + length - o)))
+
+    payloads = []
+    current = []
+    size = 0
+    for piece in pieces:
+        header_size = HEADER.size + RANGE.size * (len(current) + 1)
+        data_offset = (header_size + DATA_ALIGN - 1) // DATA_ALIGN * DATA_ALIGN
+        if current and data_offset + size + piece[1] > max_size:
+            payloads.append(current)
+            current, size = [], 0
+        current.append(piece)
+        size += piece[1]
+    if current:
+        payloads.append(current)
+
+    for pieces in payloads:
+        header_size = HEADER.size + RANGE.size * len(pieces)
+        data_offset = (header_size + DATA_ALIGN - 1) // DATA_ALIGN * DATA_ALIGN
+
+        out = bytearray(HEADER.pack(DELTA_MAGIC, len(pieces), data_offset, 0))
+        for offset, length in pieces:
+            out += RANGE.pack(offset, length, 0)
+        out += bytes(data_offset - len(out))
+        for offset, length in pieces:
+            out += image[offset:offset + length]
+        yield bytes(out), pieces
+
+
+def main():
+    parser = argparse.ArgumentParser(description='flash only the changed parts of a raw partition image')
+    parser.add_argument('partition', help='partition label on the device')
+    parser.add_argument('image', help='raw (non-sparse) image')
+    parser.add_argument('-s', '--serial', help='device serial number')
+    parser.add_argument('--fastboot', default='fastboot', help='fastboot binary')
+    parser.add_argument('--range-size', type=lambda x: int(x, 0), default=DEFAULT_RANGE_SIZE,
+                        help='bytes per checksum, a multiple of the block size')
+    parser.add_argument('--dry-run', action='store_true', help='only show what would be written')
+    parser.add_argument('-o', '--output', help='write the payloads to OUTPUT.N instead of flashing them')
+    parser.add_argument('--verify', action='store_true', help='compare all checksums again afterwards')
+    args = parser.parse_args()
+
+    with open(args.image, 'rb') as f:
+        image = f.read()
+
+    try:
+        if len(image) >= 4 and struct.unpack_from('<I', image)[0] == SPARSE_MAGIC:
+            raise DeltaError('%s is a sparse image, convert it with simg2img first' % args.image)
+
+        fastboot = Fastboot(args.fastboot, args.serial)
+        sums = fastboot.block_sums(args.partition, args.range_size, len(image))
+        ranges = changed_ranges(image, sums, args.range_size)
+        changed = sum(r[1] for r in ranges)
+        print('%d of %d bytes changed in %d ranges' % (changed, len(image), len(ranges)))
+
+        if args.dry_run or not ranges:
+            return
+
+        for n, (payload, pieces) in enumerate(build_payloads(image, ranges, fastboot.max_download_size())):
+            if args.output:
+                with open('%s.%d' % (args.output, n), 'wb') as f:
+                    f.write(payload)
+                continue
+
+            with tempfile.NamedTemporaryFile(suffix='.delta', delete=False) as f:
+                f.write(payload)
+            try:
+                fastboot.run('stage', f.name)
+                print(fastboot.run('oem', 'delta-write', args.partition).strip())
+            finally:
+                os.unlink(f.name)
+
+        if args.verify and not args.output:
+            if changed_ranges(image, fastboot.block_sums(args.partition, args.range_size, len(image)), args.range_size):
+                raise DeltaError('verification failed')
+            print('verified')
+    except DeltaError as e:
+        sys.exit(str(e))
+
+
+if __name__ == '__main__':
+    main()
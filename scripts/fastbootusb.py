@@ -0,0 +1,77 @@
+#
+# Minimal fastboot protocol over pyusb, for the oem commands whose data
+# phase the stock fastboot client can't handle. The bootloader needs to be
+# built with FASTBOOT_USB_RAW for those commands to exist.
+
+import sys
+
+try:
+    import usb.core
+    import usb.util
+except ImportError:
+    sys.exit('pyusb is required')
+
+FASTBOOT_CLASS = (0xff, 0x42, 0x03)
+MAX_RSP_SIZE = 64
+
+USBError = usb.core.USBError
+
+
+class FastbootError(Exception):
+    pass
+
+
+def is_fastboot(intf):
+    return (intf.bInterfaceClass, intf.bInterfaceSubClass, intf.bInterfaceProtocol) == FASTBOOT_CLASS
+
+
+class FastbootUsb:
+    def __init__(self, serial=None, timeout=10000):
+        self.timeout = timeout
+
+        for dev in usb.core.find(find_all=True):
+            for cfg in dev:
+                for intf in cfg:
+                    if not is_fastboot(intf):
+                        continue
+                    if serial and usb.util.get_string(dev, dev.iSerialNumber) != serial:
+                        continue
+
+                    self.dev = dev
+                    self.ep_out = usb.util.find_descriptor(intf, custom_match=lambda e:
+                        usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_OUT)
+                    self.ep_in = usb.util.find_descriptor(intf, custom_match=lambda e:
+                        usb.util.endpoint_direction(e.bEndpointAddress) == usb.util.ENDPOINT_IN)
+                    return
+
+        raise FastbootError('no fastboot device found')
+
+    def response(self, timeout=None):
+        # prints INFO lines until the device answers with something else
+        while True:
+            rsp = bytes(self.ep_in.read(MAX_RSP_SIZE, timeout or self.timeout)).decode('ascii', 'replace')
+            if rsp.startswith('INFO'):
+                print('(bootloader) %s' % rsp[4:])
+                continue
+            return rsp
+
+    def command(self, cmd, timeout=None):
+        # returns the size of the data phase, or None if the command finished
+        self.ep_out.write(cmd.encode('ascii'), self.timeout)
+        rsp = self.response(timeout)
+        if rsp.startswith('DATA'):
+            return int(rsp[4:], 16)
+        if rsp.startswith('OKAY'):
+            return None
+        raise FastbootError('%s: %s' % (cmd, rsp))
+
+    def finish(self, timeout=None):
+        rsp = self.response(timeout)
+        if not rsp.startswith('OKAY'):
+            raise FastbootError(rsp)
+
+    def read(self, n):
+        return bytes(self.ep_in.read(n, self.timeout))
+
+    def write(self, buf):
+        return self.ep_out.write(buf, self.timeout)
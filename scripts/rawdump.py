@@ -0,0 +1,61 @@
+#!/usr/bin/env python3
+#
+# Receives the data phase of 'oem dump-mem ... raw', 'oem ramdump ... raw'
+# and 'oem dump-partition' into a file, e.g.
+#   rawdump.py -o mem.bin oem dump-mem 80000000 00100000 raw
+#   rawdump.py -o boot.img oem dump-partition boot
+#   rawdump.py -o ram.dump --resume oem ramdump raw
+
+import argparse
+import os
+import sys
+import time
+
+from fastbootusb import FastbootUsb, FastbootError, USBError
+
+# a multiple of the device's 32K requests
+READ_SIZE = 1 << 20
+
+
+def main():
+    parser = argparse.ArgumentParser(description='save the raw data phase of an oem dump command')
+    parser.add_argument('command', nargs='+', help='the fastboot command, e.g. oem dump-partition boot')
+    parser.add_argument('-o', '--output', required=True, help='file to write the data to')
+    parser.add_argument('--resume', action='store_true',
+                        help='append to OUTPUT and pass its size as the ramdump offset')
+    parser.add_argument('-s', '--serial', help='device serial number')
+    parser.add_argument('--timeout', type=int, default=10000, help='per transfer, in ms')
+    args = parser.parse_args()
+
+    cmd = ' '.join(args.command)
+    mode = 'wb'
+    if args.resume and os.path.exists(args.output):
+        cmd += ' %x' % os.path.getsize(args.output)
+        mode = 'ab'
+
+    try:
+        fb = FastbootUsb(args.serial, args.timeout)
+
+        # compressed dumps are built before the data phase starts
+        size = fb.command(cmd, 10 * args.timeout)
+        if size is None:
+            raise FastbootError('%s has no data phase' % cmd)
+
+        done = 0
+        start = time.monotonic()
+        with open(args.output, mode) as f:
+            while done < size:
+                buf = fb.read(min(READ_SIZE, size - done))
+                f.write(buf)
+                done += len(buf)
+        elapsed = time.monotonic() - start
+
+        fb.finish()
+    except (USBError, FastbootError) as e:
+        sys.exit(str(e))
+
+    print('host: %d bytes in %.3fs: %.2f MB/s' % (done, elapsed, done / max(elapsed, 1e-6) / (1 << 20)))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,246 @@
+#!/usr/bin/env python3
+#
+# Decodes and verifies LZ4 compressed dumps from the 'oem dump-*' fastboot
+# commands. The input is either the raw frame of a 'raw lz4' dump or the
+# output of a base64 dump, with or without the '(bootloader) ' prefixes.
+
+import argparse
+import base64
+import re
+import struct
+import sys
+import zlib
+
+LZ4_MAGIC = 0x184D2204
+BLOCK_SIZES = {4: 64 << 10, 5: 256 << 10, 6: 1 << 20, 7: 4 << 20}
+
+try:
+    import lz4.block as lz4_block
+except ImportError:
+    lz4_block = None
+
+try:
+    import xxhash
+except ImportError:
+    xxhash = None
+
+
+class DumpError(Exception):
+    pass
+
+
+def rotl32(x, r):
+    return ((x << r) | (x >> (32 - r))) & 0xffffffff
+
+
+def xxh32(data, seed=0):
+    if xxhash:
+        return xxhash.xxh32_intdigest(data, seed)
+
+    p1, p2, p3, p4, p5 = 2654435761, 2246822519, 3266489917, 668265263, 374761393
+    n = len(data)
+    i = 0
+
+    if n >= 16:
+        v = [(seed + p1 + p2) & 0xffffffff, (seed + p2) & 0xffffffff, seed, (seed - p1) & 0xffffffff]
+        while i + 16 <= n:
+            for j, w in enumerate(struct.unpack_from('<4I', data, i)):
+                v[j] = (rotl32((v[j] + w * p2) & 0xffffffff, 13) * p1) & 0xffffffff
+            i += 16
+        h = rotl32(v[0], 1) + rotl32(v[1], 7) + rotl32(v[2], 12) + rotl32(v[3], 18)
+    else:
+        h = seed + p5
+
+    h = (h + n) & 0xffffffff
+
+    while i + 4 <= n:
+        h = (h + struct.unpack_from('<I', data, i)[0] * p3) & 0xffffffff
+        h = (rotl32(h, 17) * p4) & 0xffffffff
+        i += 4
+
+    while i < n:
+        h = (h + data[i] * p5) & 0xffffffff
+        h = (rotl32(h, 11) * p1) & 0xffffffff
+        i += 1
+
+    h ^= h >> 15
+    h = (h * p2) & 0xffffffff
+    h ^= h >> 13
+    h = (h * p3) & 0xffffffff
+    h ^= h >> 16
+    return h
+
+
+def read_length(src, i, length):
+    if length == 15:
+        while True:
+            b = src[i]
+            i += 1
+            length += b
+            if b != 255:
+                break
+    return length, i
+
+
+def decode_block(src, out, block_start, independent):
+    i = 0
+    n = len(src)
+
+    while True:
+        token = src[i]
+        i += 1
+
+        litlen, i = read_length(src, i, token >> 4)
+        if i + litlen > n:
+            raise DumpError('literals exceed block')
+        out += src[i:i + litlen]
+        i += litlen
+
+        if i == n:
+            break
+
+        offset = src[i] | (src[i + 1] << 8)
+        i += 2
+
+        window = len(out) - block_start if independent else len(out)
+        if offset == 0 or offset > window:
+            raise DumpError('invalid match offset %d' % offset)
+
+        mlen, i = read_length(src, i, token & 15)
+        mlen += 4
+
+        start = len(out) - offset
+        if offset >= mlen:
+            out += out[start:start + mlen]
+        else:
+            # overlapping matches repeat the last 'offset' bytes
+            pattern = bytes(out[start:])
+            out += (pattern * (mlen // offset + 1))[:mlen]
+
+
+def decode_frame(data):
+    if len(data) < 7 or struct.unpack_from('<I', data, 0)[0] != LZ4_MAGIC:
+        raise DumpError('no LZ4 frame')
+
+    flg, bd = data[4], data[5]
+    if flg >> 6 != 1:
+        raise DumpError('unsupported frame version')
+
+    independent = bool(flg & 0x20)
+    block_checksum = bool(flg & 0x10)
+    content_size = bool(flg & 0x08)
+    content_checksum = bool(flg & 0x04)
+    dict_id = bool(flg & 0x01)
+
+    block_max = BLOCK_SIZES.get((bd >> 4) & 7)
+    if not block_max:
+        raise DumpError('invalid block size')
+
+    hdr_end = 6 + (8 if content_size else 0) + (4 if dict_id else 0)
+    if len(data) < hdr_end + 1:
+        raise DumpError('truncated header')
+    if data[hdr_end] != (xxh32(data[4:hdr_end]) >> 8) & 0xff:
+        raise DumpError('header checksum mismatch')
+
+    expected_size = struct.unpack_from('<Q', data, 6)[0] if content_size else None
+
+    out = bytearray()
+    i = hdr_end + 1
+    blocks = 0
+
+    while True:
+        if i + 4 > len(data):
+            raise DumpError('truncated frame')
+        bsize = struct.unpack_from('<I', data, i)[0]
+        i += 4
+        if bsize == 0:
+            break
+
+        uncompressed = bool(bsize & 0x80000000)
+        bsize &= 0x7fffffff
+        if bsize > block_max or i + bsize > len(data):
+            raise DumpError('invalid block size %d' % bsize)
+
+        block = data[i:i + bsize]
+        i += bsize
+
+        if block_checksum:
+            if xxh32(block) != struct.unpack_from('<I', data, i)[0]:
+                raise DumpError('block %d checksum mismatch' % blocks)
+            i += 4
+
+        start = len(out)
+        if uncompressed:
+            out += block
+        elif lz4_block and independent:
+            out += lz4_block.decompress(block, uncompressed_size=block_max)
+        else:
+            decode_block(block, out, start, independent)
+
+        if len(out) - start > block_max:
+            raise DumpError('block %d exceeds the maximum size' % blocks)
+        blocks += 1
+
+    if content_checksum:
+        if i + 4 > len(data):
+            raise DumpError('missing content checksum')
+        if xxh32(bytes(out)) != struct.unpack_from('<I', data, i)[0]:
+            raise DumpError('content checksum mismatch')
+        i += 4
+
+    if expected_size is not None and expected_size != len(out):
+        raise DumpError('content size mismatch')
+
+    return bytes(out), blocks, len(data) - i
+
+
+def parse_log(text):
+    # the payload are the INFO lines, the checksum of the transfer is the last one
+    payload = []
+    crc = None
+
+    for line in text.splitlines():
+        line = re.sub(r'^\(bootloader\)\s?', '', line.strip())
+        m = re.match(r'^crc32:([0-9a-fA-F]{8})$', line)
+        if m:
+            crc = int(m.group(1), 16)
+        elif re.match(r'^[A-Za-z0-9+/=]+$', line):
+            payload.append(line)
+
+    data = base64.b64decode(''.join(payload))
+    if crc is not None and zlib.crc32(data) & 0xffffffff != crc:
+        raise DumpError('transfer crc32 mismatch')
+
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description='decode and verify LZ4 compressed fastboot dumps')
+    parser.add_argument('input', help='raw LZ4 frame or fastboot output of a base64 dump')
+    parser.add_argument('-o', '--output', help='where to write the decompressed data')
+    args = parser.parse_args()
+
+    with open(args.input, 'rb') as f:
+        data = f.read()
+
+    try:
+        if data[:4] != struct.pack('<I', LZ4_MAGIC):
+            data = parse_log(data.decode('ascii', 'replace'))
+
+        out, blocks, trailing = decode_frame(data)
+    except (DumpError, IndexError, ValueError) as e:
+        sys.exit('%s: %s' % (args.input, e))
+
+    if trailing:
+        print('warning: %d trailing bytes after the frame' % trailing, file=sys.stderr)
+
+    print('%d -> %d bytes in %d blocks, ratio %.2f, checksums ok' %
+          (len(data), len(out), blocks, len(out) / max(len(data), 1)))
+
+    if args.output:
+        with open(args.output, 'wb') as f:
+            f.write(out)
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,56 @@
+#!/usr/bin/env python3
+#
+# Host side of 'oem usb-bench'. The stock fastboot client can't handle a
+# data phase after an oem command, so this talks to the fastboot
+# interface directly through pyusb.
+
+import argparse
+import sys
+import time
+
+from fastbootusb import FastbootUsb, FastbootError, USBError
+
+
+def main():
+    parser = argparse.ArgumentParser(description='measure the fastboot USB throughput without touching storage')
+    parser.add_argument('mode', choices=['sink', 'source'], help='sink: host to device, source: device to host')
+    parser.add_argument('size', type=lambda x: int(x, 0), help='bytes to transfer')
+    parser.add_argument('--chunk', type=lambda x: int(x, 0), default=32 * 1024,
+                        help='bytes per transfer, on both sides')
+    parser.add_argument('-s', '--serial', help='device serial number')
+    parser.add_argument('--timeout', type=int, default=10000, help='per transfer, in ms')
+    args = parser.parse_args()
+
+    try:
+        fb = FastbootUsb(args.serial, args.timeout)
+
+        if fb.command('oem usb-bench %s %08x %x' % (args.mode, args.size, args.chunk)) is None:
+            raise FastbootError('no data phase')
+
+        buf = bytes(args.chunk)
+        done = 0
+        transfers = 0
+        shorts = 0
+        start = time.monotonic()
+        while done < args.size:
+            n = min(args.chunk, args.size - done)
+            if args.mode == 'sink':
+                ret = fb.write(buf[:n])
+            else:
+                ret = len(fb.read(n))
+            transfers += 1
+            if ret < n:
+                shorts += 1
+            done += ret
+        elapsed = time.monotonic() - start
+
+        fb.finish()
+    except (USBError, FastbootError) as e:
+        sys.exit(str(e))
+
+    print('host: %d bytes in %.3fs: %.2f MB/s, %d transfers, %d short' %
+          (done, elapsed, done / max(elapsed, 1e-6) / (1 << 20), transfers, shorts))
+
+
+if __name__ == '__main__':
+    main()